@@ -0,0 +1,58 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <pic18fregs.h>
+#include "typedef.h"
+#include "bringup.h"
+
+#define BRINGUP_TIMER 0x87      // on, 16 bit, Fosc/4, 1:256
+#define TIMER_RESET   0xFF      // T0CON after reset
+
+u16 bringup_times[BRINGUP_MILESTONES];
+
+void bringup_start(void) {
+	u8 i;
+
+	TMR0H = 0;
+	TMR0L = 0;
+	T0CON = BRINGUP_TIMER;
+	for (i = 0; i < BRINGUP_MILESTONES; i++) {
+		bringup_times[i] = BRINGUP_NONE;
+	}
+}
+
+void bringup_mark(u8 milestone) {
+	u8 low;
+
+	if (bringup_times[milestone] != BRINGUP_NONE) {
+		return;
+	}
+	// Reading TMR0L latches TMR0H
+	low = TMR0L;
+	bringup_times[milestone] = low | (u16) TMR0H << 8;
+}
+
+/*
+ * Timer0 is handed to the application as after reset
+ */
+void bringup_stop(void) {
+	T0CON = TIMER_RESET;
+	TMR0H = 0;
+	TMR0L = 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Time of the bring-up milestones
+ *
+ * Timer0 counts from main in 16 bit mode with a 1:256 prescaler, one
+ * tick is 256 instruction cycles (21.33 us at 48 MHz), it wraps after
+ * 1.4 s. Only the first time a milestone is reached is kept, milestones
+ * never reached read BRINGUP_NONE. VENDOR_GET_BRINGUP returns the times
+ * in the order of the milestones, 2 bytes each, low byte first.
+ */
+
+#define BRINGUP_DECIDED    0    // boot decision, staying in the bootloader
+#define BRINGUP_ATTACHED   1    // USB module enabled, pull-up on the bus
+#define BRINGUP_RESET      2    // first bus reset
+#define BRINGUP_DESCRIPTOR 3    // first GET_DESCRIPTOR
+#define BRINGUP_ADDRESS    4    // address assigned
+#define BRINGUP_CONFIGURED 5    // configuration set
+#define BRINGUP_DFU        6    // first DFU request
+#define BRINGUP_MILESTONES 7
+
+#define BRINGUP_NONE       0xFFFF
+
+extern u16 bringup_times[BRINGUP_MILESTONES];
+
+void bringup_start(void);
+void bringup_mark(u8 milestone);
+void bringup_stop(void);
@@ -19,8 +19,20 @@
 
 /*
  * Application start address
+ *
+ * BOOT_TOP (make LAYOUT=top) puts the bootloader into the top 16 KB of
+ * flash and the application at 0x0000 with its native interrupt
+ * vectors. The reset vector of a received image is moved to APP_RESET,
+ * the last 4 bytes below the bootloader, 0x0000 always jumps to the
+ * bootloader.
  */
+#ifdef BOOT_TOP
+#define ENTRY 0x0000
+#define ENTRY_STRING '0',0x00,'0',0x00,'0',0x00,'0',0x00
+#else
 #define ENTRY 0x4000
+#define ENTRY_STRING '4',0x00,'0',0x00,'0',0x00,'0',0x00
+#endif
 
 /*
  * Comment out the next two lines if there is no led
@@ -35,12 +47,88 @@
 #define BUTTON_PORT PORTB
 #define BUTTON_PIN 4
 
+/*
+ * Comment out the next line to disable the bulk transfer interface
+ */
+#define BULK_TRANSFER
+
+/*
+ * Check the CRC of the image after power on and brown-out resets, a
+ * corrupted image is not started. crcFlash takes about 25 instruction
+ * cycles per byte, a 16 KB image delays the start of the application by
+ * about 35 ms. Warm resets only check the image record. Comment out the
+ * next line to check only the record after every reset, the CRC is then
+ * verified at manifestation only.
+ */
+#define BOOT_VERIFY_CRC
+
+/*
+ * Boot request flag, an application writes BOOT_REQUEST_MAGIC to
+ * BOOT_REQUEST_ADDR and executes a RESET instruction to enter the
+ * bootloader. RAM keeps its content on every reset except power on.
+ */
+#define BOOT_REQUEST_ADDR 0x03FE
+#define BOOT_REQUEST_MAGIC 0xB00D
+
+/*
+ * Access bank layout of the state used by every USB/DFU request, no
+ * BANKSEL is needed for it. SDCC allocates its temporaries from 0x00 up,
+ * the block grows down from the top of the access RAM. Applications
+ * using the services keep their access RAM below ACCESS_STATE_START.
+ */
+#define ACCESS_USB_DEVICE_STATE 0x5F
+#define ACCESS_USB_ACTIVE_CFG   0x5E
+#define ACCESS_USB_ALT_SETTING  0x5D
+#define ACCESS_EP0_STATE        0x5C
+#define ACCESS_DFU_OP_STATE     0x5B
+#define ACCESS_DFU_SUB_COMMAND  0x5A
+#define ACCESS_DFU_BUSY         0x59
+#define ACCESS_EP0_LENGTH       0x57 // num_bytes_to_be_send (2)
+#define ACCESS_EP0_SOURCE       0x54 // sourceData, generic pointer (3)
+#define ACCESS_DFU_STATUS       0x4E // DFU_Status (6)
+#define ACCESS_DFU_ADDRESS      0x4A // address (4)
+#define ACCESS_STATE_START      0x4A
+
 /*
  * Internal config
  */
-#define FLASH_END 0x7FFF
-#define EP0_BUFFER_SIZE 32
-#define DATA_BUFFER_SIZE 32
-#define ERASE_PAGE_SIZE 64
+#include "mcu.h"
+#define BOOT_SIZE 0x4000
+#ifdef BOOT_TOP
+#define BOOT_START (FLASH_END + 1 - BOOT_SIZE)
+#define APP_END (BOOT_START - 1)
+#define APP_RESET (BOOT_START - 4)
+#else
+#define APP_END FLASH_END
+#define APP_RESET ENTRY
+#endif
+#define EP0_BUFFER_SIZE TRANSFER_SIZE
+#define DATA_BUFFER_SIZE ERASE_PAGE_SIZE // DFU block, several ep0 packets
 #define MASS_ERASE_TIME 0x04FF
-#define WRITE_TIME 0x0004
+#define ERASE_TIME 0x0005        // per page of an erase range
+#define WRITE_TIME 0x0004        // per FLASH_WRITE_SIZE bytes
+#define BLOCK_TIME (WRITE_TIME * (DATA_BUFFER_SIZE / FLASH_WRITE_SIZE))
+#define MANIFEST_TIME 0x0040
+#define EEPROM_WRITE_TIME 0x0080 // per EEPROM_PAGE_SIZE bytes
+#define EEPROM_BLOCK_TIME (EEPROM_WRITE_TIME * (DATA_BUFFER_SIZE / EEPROM_PAGE_SIZE))
+#define STREAM_TIME 0x0040
+#define JOURNAL_INTERVAL 1024
+#define JOURNAL_SLOTS 8
+#define STATS_SLOTS 4
+
+/*
+ * Data EEPROM layout, the first EEPROM_APP_SIZE bytes belong to the
+ * application and can be written with alternate setting 1
+ */
+#define EEPROM_ADDRESS 0xF00000
+#ifdef FLASH_ADDR_16
+#define EEPROM_BASE 0xF000       // EEPROM_ADDRESS in 16 bit flash addresses
+#else
+#define EEPROM_BASE EEPROM_ADDRESS
+#endif
+#define EEPROM_SIZE 0x100
+#define EEPROM_APP_SIZE 0x80
+#define EEPROM_PAGE_SIZE 32
+#define EEPROM_STATS 0x80       // STATS_SLOTS * 16 bytes
+#define EEPROM_JOURNAL 0xC0      // JOURNAL_SLOTS * 6 bytes
+#define EEPROM_IMAGE_RECORD 0xF0 // crc (2), length (2), state (1)
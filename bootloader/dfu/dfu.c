@@ -29,21 +29,58 @@
 #include "typedef.h"
 #include "debug.h"
 #include "usb/usb_std_req.h"
+#include "usb/usb_descriptors.h"
+#include "usb/usb.h"
+#ifdef BULK_TRANSFER
+#include "usb/ep1.h"
+#endif
+#include "usb/usb_ram.h"
 #include "dfu/dfu.h"
+#include "dfu/stream.h"
 #include "flash.h"
+#include "eeprom.h"
+#include "journal.h"
+#include "stats.h"
+#include "bringup.h"
 #include "config.h"
 
-DFU_Status dfu_status;
-DFU_OP_State dfu_op_state;
-u8 dfuBusy;
-u8 dfuSubCommand;
-u32 address = 0;
-u8 transfer[DATA_BUFFER_SIZE];
+/*
+ * Image tracking states
+ */
+#define IMAGE_CLEAN     0 // Flash not modified in this session
+#define IMAGE_STREAM    1 // CRC follows the written blocks in address order
+#define IMAGE_UNORDERED 2 // CRC is calculated from flash at manifestation
+
+#pragma udata access dfu_status
+DFU_Status __at(ACCESS_DFU_STATUS) dfu_status;
+#pragma udata access dfu_op_state
+u8 __at(ACCESS_DFU_OP_STATE) dfu_op_state;      // DFU_OP_State
+#pragma udata access dfuBusy
+u8 __at(ACCESS_DFU_BUSY) dfuBusy;
+#pragma udata access dfuSubCommand
+u8 __at(ACCESS_DFU_SUB_COMMAND) dfuSubCommand;
+#pragma udata access address
+flash_addr __at(ACCESS_DFU_ADDRESS) address;
+u16 erase_count;
 u16 transfer_length;
+u8 dfu_boot_status = OK;
+u8 image_state = IMAGE_CLEAN;
+u16 image_crc;
+flash_addr image_end;
+flash_addr journal_address;
+flash_addr error_address;
+
+/*
+ * Answer of DFU_UPLOAD with wValue 0
+ */
+const u8 dfu_commands[] = {
+	GET_COMMAND_TOKEN, SET_ADDRESS_TOKEN, ERASE_PAGE_TOKEN,
+	ERASE_RANGE_TOKEN, PATCH_TOKEN, COMPRESSED_TOKEN
+};
 
 void* memcpy(void *dest, const void *src, u16 count) {
-    char *dst8 = (u8 *)dest;
-    char *src8 = (u8 *)src;
+    u8 *dst8 = (u8 *)dest;
+    const u8 *src8 = (const u8 *)src;
 
     while (count--) {
         *dst8++ = *src8++;
@@ -51,6 +88,41 @@ void* memcpy(void *dest, const void *src, u16 count) {
     return dest;
 }
 
+/*
+ * Memory of the active alternate setting
+ */
+u8 alt_eeprom(void) {
+	return GET_ACTIVE_ALTERNATE_SETTING() == ALT_EEPROM;
+}
+
+flash_addr memory_start(void) {
+	return alt_eeprom() ? EEPROM_BASE : ENTRY;
+}
+
+flash_addr memory_end(void) {
+	return alt_eeprom() ? EEPROM_BASE + EEPROM_SIZE - 1 : APP_END;
+}
+
+/*
+ * Address of a DfuSe command, with 16 bit flash addresses the data
+ * EEPROM moves to EEPROM_BASE and anything else above 64 KB to 0xFFFF,
+ * which fails every range check
+ */
+flash_addr command_address(u8 *buffer) {
+#ifdef FLASH_ADDR_16
+	if (buffer[4] == 0 && buffer[3] == 0) {
+		return buffer[1] | (u16) buffer[2] << 8;
+	}
+	if (buffer[4] == 0 && buffer[3] == ((EEPROM_ADDRESS >> 16) & 0xFF)
+			&& buffer[2] < (EEPROM_SIZE >> 8)) {
+		return EEPROM_BASE + (buffer[1] | (u16) buffer[2] << 8);
+	}
+	return 0xFFFF;
+#else
+	return (u32) buffer[4] << 24 | (u32) buffer[3] << 16 | (u32) buffer[2] << 8 | (u32) buffer[1];
+#endif
+}
+
 void init_dfu(void) {
 	dfu_status.bStatus = OK;
 	dfu_status.bwPollTimeout0 = 0;
@@ -61,17 +133,28 @@ void init_dfu(void) {
 	dfu_op_state = INIT;
 	dfuBusy = 0;
 	address = 0;
+	// Bus reset, SET_INTERFACE and DFU_CLRSTATUS end a stream
+	stream_abort();
+	if (dfu_boot_status != OK) {
+		dfu_status.bState = dfuERROR;
+		dfu_status.bStatus = dfu_boot_status;
+	}
 }
 
 u8 process_dfu_request(StandardRequest *request) {
 	u8 currentState = dfu_status.bState;
-	dfu_status.bStatus = OK;
+
+	// The status of a failed operation is kept until DFU_CLRSTATUS
+	if (currentState != dfuERROR) {
+		dfu_status.bStatus = OK;
+	}
 
 	// debug2(" rtyp: %d\n", request->bmRequestType);
 	// debug2(" rqst: %d\n", request->bRequest);
 	// debug2("DFU Index  : %d\r\n", request->wIndex);
 
 	dfuBusy = 1;
+	bringup_mark(BRINGUP_DFU);
 
 	if (currentState == dfuIDLE) {
 		dfuBusy = 1;
@@ -103,7 +186,7 @@ u8 process_dfu_request(StandardRequest *request) {
 					dfuSubCommand = DFU_CMD_GET_CMD;
 				} else {
 					dfuSubCommand = DFU_CMD_UPLOAD;
-					address = ENTRY;
+					address = memory_start();
 				}
 			} else {
 				dfu_status.bState = dfuERROR;
@@ -112,6 +195,7 @@ u8 process_dfu_request(StandardRequest *request) {
 		} else if (request->bRequest == DFU_ABORT) {
 			dfu_status.bState = dfuIDLE;
 			dfu_status.bStatus = OK;
+			stream_abort();
 		} else if (request->bRequest == DFU_GETSTATUS) {
 			dfu_status.bState = dfuIDLE;
 		} else if (request->bRequest == DFU_GETSTATE) {
@@ -133,9 +217,23 @@ u8 process_dfu_request(StandardRequest *request) {
 					dfu_status.bwPollTimeout0 = LOWB(MASS_ERASE_TIME);
 					dfu_status.bwPollTimeout1 = HIGHB(MASS_ERASE_TIME);
 					dfu_status.bwPollTimeout2 = 0x00;
+				} else if (dfuSubCommand == DFU_CMD_ERASE_RANGE) {
+					u16 timeout = erase_count * (alt_eeprom() ? EEPROM_WRITE_TIME : ERASE_TIME);
+					dfu_status.bwPollTimeout0 = LOWB(timeout);
+					dfu_status.bwPollTimeout1 = HIGHB(timeout);
+					dfu_status.bwPollTimeout2 = 0x00;
+				} else if (dfuSubCommand == DFU_CMD_PATCH
+						|| dfuSubCommand == DFU_CMD_COMPRESSED || stream_active()) {
+					dfu_status.bwPollTimeout0 = LOWB(STREAM_TIME);
+					dfu_status.bwPollTimeout1 = HIGHB(STREAM_TIME);
+					dfu_status.bwPollTimeout2 = 0x00;
+				} else if (alt_eeprom()) {
+					dfu_status.bwPollTimeout0 = LOWB(EEPROM_BLOCK_TIME);
+					dfu_status.bwPollTimeout1 = HIGHB(EEPROM_BLOCK_TIME);
+					dfu_status.bwPollTimeout2 = 0x00;
 				} else {
-					dfu_status.bwPollTimeout0 = LOWB(WRITE_TIME);
-					dfu_status.bwPollTimeout1 = HIGHB(WRITE_TIME);
+					dfu_status.bwPollTimeout0 = LOWB(BLOCK_TIME);
+					dfu_status.bwPollTimeout1 = HIGHB(BLOCK_TIME);
 					dfu_status.bwPollTimeout2 = 0x00;
 				}
 				dfu_status.bState = dfuDNBUSY;
@@ -163,7 +261,12 @@ u8 process_dfu_request(StandardRequest *request) {
 
 	} else if (currentState == dfuDNBUSY) {
 		/* if were actually done writing, goto sync, else stay busy */
-		if (dfu_op_state == END) {
+		if (request->bRequest != DFU_GETSTATUS
+				&& request->bRequest != DFU_GETSTATE) {
+			// The block in DataBuffer may not be overwritten yet
+			dfu_status.bState = dfuERROR;
+			dfu_status.bStatus = errSTALLEDPKT;
+		} else if (dfu_op_state == END) {
 			dfu_status.bwPollTimeout0 = 0x00;
 			dfu_status.bwPollTimeout1 = 0x00;
 			dfu_status.bwPollTimeout2 = 0x00;
@@ -189,6 +292,7 @@ u8 process_dfu_request(StandardRequest *request) {
 		} else if (request->bRequest == DFU_ABORT) {
 			dfu_status.bState = dfuIDLE;
 			address = 0;
+			stream_abort();
 		} else if (request->bRequest == DFU_GETSTATUS) {
 			dfu_status.bState = dfuDNLOAD_IDLE;
 		} else if (request->bRequest == DFU_GETSTATE) {
@@ -202,6 +306,9 @@ u8 process_dfu_request(StandardRequest *request) {
 		/* device has received last block, waiting DFU_GETSTATUS request */
 
 		if (request->bRequest == DFU_GETSTATUS) {
+			dfu_status.bwPollTimeout0 = LOWB(MANIFEST_TIME);
+			dfu_status.bwPollTimeout1 = HIGHB(MANIFEST_TIME);
+			dfu_status.bwPollTimeout2 = 0x00;
 			dfu_status.bState = dfuMANIFEST;
 			dfu_status.bStatus = OK;
 		} else if (request->bRequest == DFU_GETSTATE) {
@@ -237,6 +344,7 @@ u8 process_dfu_request(StandardRequest *request) {
 		} else if (request->bRequest == DFU_ABORT) {
 			dfu_status.bState = dfuIDLE;
 			address = 0;
+			stream_abort();
 		} else if (request->bRequest == DFU_GETSTATUS) {
 			dfu_status.bState = dfuUPLOAD_IDLE;
 		} else if (request->bRequest == DFU_GETSTATE) {
@@ -255,6 +363,7 @@ u8 process_dfu_request(StandardRequest *request) {
 		} else if (request->bRequest == DFU_GETSTATE) {
 			dfu_status.bState = dfuERROR;
 		} else if (request->bRequest == DFU_CLRSTATUS) {
+			dfu_boot_status = OK;
 			init_dfu();
 		} else {
 			dfu_status.bState = dfuERROR;
@@ -267,6 +376,12 @@ u8 process_dfu_request(StandardRequest *request) {
 		dfu_status.bStatus = errSTALLEDPKT;
 	}
 
+	if (currentState == dfuERROR) {
+		return request->bRequest == DFU_GETSTATUS
+				|| request->bRequest == DFU_GETSTATE
+				|| request->bRequest == DFU_CLRSTATUS;
+	}
+
 	if (dfu_status.bStatus == OK) {
 		return TRUE;
 	} else {
@@ -275,41 +390,439 @@ u8 process_dfu_request(StandardRequest *request) {
 
 }
 
-void dfuExecCommand() {
+/*
+ * Image tracking, the CRC of the image is calculated while the blocks
+ * are written and the image record is invalid until manifestation
+ */
+void image_touch(void) {
+	if (image_state == IMAGE_CLEAN) {
+		writeEeprom(EEPROM_IMAGE_RECORD + 4, IMAGE_RECORD_INVALID);
+		stats_begin();
+		image_crc = 0xFFFF;
+		image_end = ENTRY;
+		image_state = IMAGE_STREAM;
+		journal_address = ENTRY;
+	}
+}
+
+#ifdef BOOT_TOP
+/*
+ * Reset vector handling with the bootloader at the top of flash,
+ * 0x0000 holds a goto BOOT_START and the reset vector of the image is
+ * written to APP_RESET at manifestation
+ */
+u8 boot_vector[4] = {
+	(BOOT_START >> 1) & 0xFF, 0xEF,
+	(BOOT_START >> 9) & 0xFF, 0xF0 | ((BOOT_START >> 17) & 0x0F)
+};
+u8 app_reset[4];
+u8 app_reset_pending = FALSE;
+
+void reset_vector_take(flash_addr program_address, u8 *buffer) {
+	u8 i;
+
+	if (program_address != ENTRY) {
+		return;
+	}
+	// A copy of the flash content (patch) is not a new reset vector
+	for (i = 0; i < 4 && buffer[i] == boot_vector[i]; i++)
+		;
+	if (i < 4) {
+		memcpy(app_reset, buffer, 4);
+		app_reset_pending = TRUE;
+	}
+	memcpy(buffer, boot_vector, 4);
+}
+
+/*
+ * Called after stream_end, the page buffer of the stream is free
+ */
+void reset_vector_write(void) {
+	flash_addr page_address = APP_RESET & ~((flash_addr) ERASE_PAGE_SIZE - 1);
+	u8 offset;
+
+	readFlash(page_address, page, ERASE_PAGE_SIZE);
+	memcpy(&page[APP_RESET - page_address], app_reset, 4);
+	eraseFlash(page_address);
+	for (offset = 0; offset < ERASE_PAGE_SIZE; offset += FLASH_WRITE_SIZE) {
+		writeFlash(page_address + offset, &page[offset], FLASH_WRITE_SIZE);
+	}
+	app_reset_pending = FALSE;
+}
+#endif
+
+/*
+ * Erase a page of the application, with BOOT_TOP the boot vector is
+ * restored at once and the reset vector of the application is kept
+ */
+void image_erase(flash_addr erase_address) {
+	erase_address &= ~((flash_addr) ERASE_PAGE_SIZE - 1);
+	image_touch();
+	stats.erased++;
+	if (erase_address < image_end) {
+		image_state = IMAGE_UNORDERED;
+	}
+#ifdef BOOT_TOP
+	if (erase_address == (APP_RESET & ~((flash_addr) ERASE_PAGE_SIZE - 1)) && !app_reset_pending) {
+		readFlash(APP_RESET, app_reset, 4);
+		app_reset_pending = TRUE;
+	}
+	eraseFlash(erase_address);
+	if (erase_address == ENTRY) {
+		writeFlash(ENTRY, boot_vector, 4);
+	}
+#else
+	eraseFlash(erase_address);
+#endif
+}
+
+void image_write(flash_addr write_address, u8 *buffer, u16 length) {
+	image_touch();
+	stats.written += length;
+	if (image_state == IMAGE_STREAM && write_address >= image_end) {
+		// Blocks skipped by the host are taken from flash as they are
+		image_crc = crcFlash(image_end, write_address - image_end, image_crc);
+		image_crc = crcBuffer(buffer, length, image_crc);
+	} else {
+		image_state = IMAGE_UNORDERED;
+	}
+	if (write_address + length > image_end) {
+		image_end = write_address + length;
+	}
+
+	// Journal complete pages, so an interrupted download can be resumed
+	if (image_state == IMAGE_STREAM && (image_end & (ERASE_PAGE_SIZE - 1)) == 0
+			&& image_end - journal_address >= JOURNAL_INTERVAL) {
+		journal_commit(image_end, image_crc);
+		journal_address = image_end;
+	}
+}
+
+/*
+ * Program a block, read it back and add it to the image. A byte still
+ * erased means the write did not happen (errPROG), any other difference
+ * is a verification error. The failing address is kept for
+ * VENDOR_GET_ERROR.
+ */
+u8 image_program(flash_addr program_address, u8 *buffer, u16 length) {
+	u16 written;
+	u8 size;
+	u8 equal;
+
+#ifdef BOOT_TOP
+	reset_vector_take(program_address, buffer);
+#endif
+	for (written = 0; written < length; written += size) {
+		size = length - written < FLASH_WRITE_SIZE ? length - written : FLASH_WRITE_SIZE;
+		writeFlash(program_address + written, &buffer[written], size);
+		equal = verifyFlash(program_address + written, &buffer[written], size);
+		if (equal != size) {
+			error_address = program_address + written + equal;
+			debug2("verify failed at: %lx\n", (u32) error_address);
+			readFlash(error_address, &size, 1);
+			return size == 0xFF ? errPROG : errVERIFY;
+		}
+	}
+	image_write(program_address, buffer, length);
+	return OK;
+}
+
+void dfuManifest() {
+	u16 length;
+	u16 old_length;
+	u16 crc;
+
+	if (stream_active()) {
+		u8 status = stream_end();
+		if (status != OK) {
+			dfu_status.bState = dfuERROR;
+			dfu_status.bStatus = status;
+			return;
+		}
+	}
+
+	if (image_state == IMAGE_CLEAN) {
+		return;
+	}
+
+	// Read back the written part and compare it with the received data
+	length = image_end - ENTRY;
+	crc = crcFlash(ENTRY, length, 0xFFFF);
+	debug2("image crc: %x\n", crc);
+
+	if (image_state == IMAGE_STREAM && crc != image_crc) {
+		debug("image verification failed\n");
+		dfu_status.bState = dfuERROR;
+		dfu_status.bStatus = errVERIFY;
+		return;
+	}
+
+#ifdef BOOT_TOP
+	if (app_reset_pending) {
+		reset_vector_write();
+		crc = crcFlash(ENTRY, length, 0xFFFF);
+	}
+#endif
+
+	// A partial update keeps the rest of the previous image
+	old_length = readEeprom(EEPROM_IMAGE_RECORD + 2)
+			| (u16) readEeprom(EEPROM_IMAGE_RECORD + 3) << 8;
+	if (old_length > length && old_length <= APP_END - ENTRY + 1) {
+		crc = crcFlash(image_end, old_length - length, crc);
+		length = old_length;
+	}
+
+	writeEeprom(EEPROM_IMAGE_RECORD, LOWB(crc));
+	writeEeprom(EEPROM_IMAGE_RECORD + 1, HIGHB(crc));
+	writeEeprom(EEPROM_IMAGE_RECORD + 2, LOWB(length));
+	writeEeprom(EEPROM_IMAGE_RECORD + 3, HIGHB(length));
+	writeEeprom(EEPROM_IMAGE_RECORD + 4, IMAGE_RECORD_VALID);
+	journal_commit(ENTRY, 0xFFFF);
+	image_state = IMAGE_CLEAN;
+	stats_end();
+}
+
+/*
+ * Boot time check of the image record, the CRC is only calculated
+ * if verify is set
+ */
+u8 dfuCheckImage(u8 verify) {
+	u8 record[5];
+	u16 length;
+	u16 crc;
+
+	readEepromBlock(EEPROM_IMAGE_RECORD, record, 5);
+
+	if (record[4] == IMAGE_RECORD_NONE) {
+		return TRUE;
+	}
+
+	if (record[4] == IMAGE_RECORD_VALID) {
+		if (!verify) {
+			return TRUE;
+		}
+		crc = record[0] | (u16) record[1] << 8;
+		length = record[2] | (u16) record[3] << 8;
+		if (crcFlash(ENTRY, length, 0xFFFF) == crc) {
+			return TRUE;
+		}
+		// Do not start this image on the next warm reset
+		writeEeprom(EEPROM_IMAGE_RECORD + 4, IMAGE_RECORD_INVALID);
+	}
+
+	dfu_boot_status = errFIRMWARE;
+	return FALSE;
+}
+
+u8 process_vendor_request(StandardRequest *request) {
+	if (request->data_transfer_direction != DEVICE_TO_HOST) {
+		return FALSE;
+	}
+	if (request->bRequest == VENDOR_GET_JOURNAL
+			|| request->bRequest == VENDOR_GET_ERROR
+			|| request->bRequest == VENDOR_GET_STATS
+			|| request->bRequest == VENDOR_GET_BRINGUP) {
+		return TRUE;
+	}
+	if (request->bRequest == VENDOR_GET_PAGE_CRC) {
+		// Pages of ERASE_PAGE_SIZE bytes, the list fits into one packet
+		u32 start = (u32) request->wValue * ERASE_PAGE_SIZE;
+		u32 end = start + (u32) request->wIndex * ERASE_PAGE_SIZE * (request->wLength / 2);
+		return request->wIndex > 0 && request->wLength <= EP0_BUFFER_SIZE
+				&& start >= ENTRY && end <= (u32) APP_END + 1;
+	}
+	return FALSE;
+}
+
+u16 read_vendor_data(StandardRequest *request, u8 *buffer, u16 max_length) {
+	u16 length = 0;
+
+	if (request->bRequest == VENDOR_GET_JOURNAL) {
+		flash_addr resume_address;
+		u16 crc;
+
+		// Only report progress which is still in flash
+		if (journal_read(&resume_address, &crc)
+				&& crcFlash(ENTRY, resume_address - ENTRY, 0xFFFF) != crc) {
+			resume_address = ENTRY;
+			crc = 0xFFFF;
+		}
+		debug2("resume at: %lx\n", (u32) resume_address);
+		length = 7;
+		buffer[0] = LOWB(resume_address);
+		buffer[1] = HIGHB(resume_address) & 0xFF;
+		buffer[2] = ((u32) resume_address >> 16) & 0xFF;
+		buffer[3] = ((u32) resume_address >> 24) & 0xFF;
+		buffer[4] = LOWB(crc);
+		buffer[5] = HIGHB(crc);
+		buffer[6] = image_state;
+	} else if (request->bRequest == VENDOR_GET_ERROR) {
+		length = 5;
+		buffer[0] = dfu_status.bStatus;
+		buffer[1] = LOWB(error_address);
+		buffer[2] = HIGHB(error_address) & 0xFF;
+		buffer[3] = ((u32) error_address >> 16) & 0xFF;
+		buffer[4] = ((u32) error_address >> 24) & 0xFF;
+	} else if (request->bRequest == VENDOR_GET_STATS) {
+		if (request->wValue < STATS_SLOTS) {
+			length = stats_read(request->wValue, buffer);
+		}
+	} else if (request->bRequest == VENDOR_GET_BRINGUP) {
+		u8 i;
+
+		for (i = 0; i < BRINGUP_MILESTONES; i++) {
+			buffer[length++] = LOWB(bringup_times[i]);
+			buffer[length++] = HIGHB(bringup_times[i]);
+		}
+	} else if (request->bRequest == VENDOR_GET_PAGE_CRC) {
+		flash_addr page_address = (flash_addr) request->wValue * ERASE_PAGE_SIZE;
+		u16 block_size = request->wIndex * ERASE_PAGE_SIZE;
+		u16 crc;
+
+		for (length = 0; length + 1 < request->wLength && length + 1 < max_length; length += 2) {
+			crc = crcFlash(page_address, block_size, 0xFFFF);
+			buffer[length] = LOWB(crc);
+			buffer[length + 1] = HIGHB(crc);
+			page_address += block_size;
+		}
+	}
+
+	if (length > max_length) {
+		length = max_length;
+	}
+	return length;
+}
+
+/*
+ * Commands on data EEPROM, only the application part can be changed
+ */
+void dfuExecEepromCommand() {
+	u8 offset = address - EEPROM_BASE;
+
 	if (dfuSubCommand == DFU_CMD_ERASE_PAGE) {
+		offset &= ~(EEPROM_PAGE_SIZE - 1);
+		if (address >= EEPROM_BASE && offset < EEPROM_APP_SIZE) {
+			fillEeprom(offset, 0xFF, EEPROM_PAGE_SIZE);
+		} else {
+			dfu_status.bState = dfuERROR;
+			dfu_status.bStatus = errADDRESS;
+		}
+	} else if (dfuSubCommand == DFU_CMD_ERASE_RANGE) {
+		offset &= ~(EEPROM_PAGE_SIZE - 1);
+		if (address >= EEPROM_BASE
+				&& offset + erase_count * EEPROM_PAGE_SIZE <= EEPROM_APP_SIZE) {
+			fillEeprom(offset, 0xFF, erase_count * EEPROM_PAGE_SIZE);
+		} else {
+			dfu_status.bState = dfuERROR;
+			dfu_status.bStatus = errADDRESS;
+		}
+	} else if (dfuSubCommand == DFU_CMD_MASS_ERASE) {
+		fillEeprom(0, 0xFF, EEPROM_APP_SIZE);
+	} else if (dfuSubCommand == DFU_CMD_PATCH
+			|| dfuSubCommand == DFU_CMD_COMPRESSED) {
+		dfu_status.bState = dfuERROR;
+		dfu_status.bStatus = errTARGET;
+	} else if (dfuSubCommand == DFU_CMD_DOWNLOAD) {
+		if (address >= EEPROM_BASE
+				&& offset + transfer_length <= EEPROM_APP_SIZE) {
+			debug2("writing eeprom: %x\n", offset);
+			writeEepromBlock(offset, (u8 __data *)DataBuffer, transfer_length);
+		} else {
+			dfu_status.bState = dfuERROR;
+			dfu_status.bStatus = errADDRESS;
+		}
+	}
+}
+
+void dfuExecCommand() {
+	if (alt_eeprom()) {
+		dfuExecEepromCommand();
+	} else if (dfuSubCommand == DFU_CMD_ERASE_PAGE) {
 		debug("erasing ...\n");
-		if (address >= ENTRY && address <= FLASH_END) {
-			eraseFlash(address);
+		if (address >= ENTRY && address <= APP_END) {
+			image_erase(address);
 		} else {
 			dfu_status.bState = dfuERROR;
 			dfu_status.bStatus = errADDRESS;
 		}
+	} else if (dfuSubCommand == DFU_CMD_ERASE_RANGE) {
+		debug2("erasing %d pages\n", erase_count);
+		address &= ~(flash_addr) (ERASE_PAGE_SIZE - 1);
+		while (erase_count--) {
+			if (address < ENTRY || address > APP_END) {
+				error_address = address;
+				dfu_status.bState = dfuERROR;
+				dfu_status.bStatus = errADDRESS;
+				break;
+			}
+			image_erase(address);
+			address += ERASE_PAGE_SIZE;
+		}
 	} else if (dfuSubCommand == DFU_CMD_MASS_ERASE) {
-		u32 erase_address;
+		flash_addr erase_address;
 		debug("start mass-erase\n");
-		for (erase_address = ENTRY; erase_address < FLASH_END; erase_address += ERASE_PAGE_SIZE) {
-			eraseFlash(erase_address);
+		image_touch();
+		for (erase_address = ENTRY; erase_address < APP_END; erase_address += ERASE_PAGE_SIZE) {
+			image_erase(erase_address);
 		}
+#ifdef BOOT_TOP
+		// Nothing to keep, the next image brings its own reset vector
+		app_reset_pending = FALSE;
+#endif
+		// Everything is erased, start a new stream
+		image_crc = 0xFFFF;
+		image_end = ENTRY;
+		image_state = IMAGE_STREAM;
+		journal_address = ENTRY;
+		journal_commit(ENTRY, 0xFFFF);
 		debug("stop mass-erase\n");
+	} else if (dfuSubCommand == DFU_CMD_PATCH) {
+		u16 crc = DataBuffer[1] | (u16) DataBuffer[2] << 8;
+		u16 length = DataBuffer[3] | (u16) DataBuffer[4] << 8;
+
+		// The patch has to be made for the image in flash
+		if (length > APP_END - ENTRY + 1
+				|| crcFlash(ENTRY, length, 0xFFFF) != crc) {
+			debug("patch does not match image\n");
+			dfu_status.bState = dfuERROR;
+			dfu_status.bStatus = errFILE;
+		} else {
+			image_touch();
+			image_state = IMAGE_UNORDERED;
+			dfu_status.bStatus = stream_begin(STREAM_PATCH, ENTRY);
+			if (dfu_status.bStatus != OK) {
+				dfu_status.bState = dfuERROR;
+			}
+		}
+	} else if (dfuSubCommand == DFU_CMD_COMPRESSED) {
+		u8 status;
+		debug2("compressed stream at %lx\n", (u32) address);
+		image_touch();
+		status = stream_begin(STREAM_LZ, address);
+		if (status != OK) {
+			dfu_status.bState = dfuERROR;
+			dfu_status.bStatus = status;
+		}
+	} else if (dfuSubCommand == DFU_CMD_DOWNLOAD && stream_active()) {
+		u8 status = stream_data((u8 __data *)DataBuffer, transfer_length);
+		if (status != OK) {
+			dfu_status.bState = dfuERROR;
+			dfu_status.bStatus = status;
+		}
 	} else if (dfuSubCommand == DFU_CMD_DOWNLOAD) {
-		if (address >= ENTRY && address <= FLASH_END) {
-			int counter;
-			int written = 0;
-			if ((FLASH_END - address + 1) < transfer_length) {
-				transfer_length = FLASH_END - address + 1;
+		if (address >= ENTRY && address <= APP_END) {
+			u8 status;
+			if ((APP_END - address + 1) < transfer_length) {
+				transfer_length = APP_END - address + 1;
 			}
-			counter = transfer_length;
-			debug2("writing address: %lx\n", address);
-			while (counter > 0) {
-				if (counter >= FLASH_WRITE_SIZE) {
-					writeFlash(address + written, (u8 __data *)&transfer[written], FLASH_WRITE_SIZE);
-				} else {
-					writeFlash(address + written, (u8 __data *)&transfer[written], counter);
-				}
-				counter = counter - FLASH_WRITE_SIZE;
-				written = written + FLASH_WRITE_SIZE;
+			debug2("writing address: %lx\n", (u32) address);
+			status = image_program(address, (u8 __data *)DataBuffer, transfer_length);
+			if (status != OK) {
+				dfu_status.bState = dfuERROR;
+				dfu_status.bStatus = status;
 			}
 		} else {
+			error_address = address;
 			dfu_status.bState = dfuERROR;
 			dfu_status.bStatus = errADDRESS;
 		}
@@ -340,16 +853,17 @@ void setManifestWaitReset() {
 
 void jump_to_app() {
     RCON |= 0x93;     // reset all reset flag
+	bringup_stop();
 	debug("Jump to app\n");
 	/* TODO: make goto variable
-	if (address >= ENTRY && address <= FLASH_END) {
+	if (address >= ENTRY && address <= APP_END) {
 		address += 4;
 	} else {
 		address = ENTRY;
 	}
 	*/
 	__asm
-		goto ENTRY
+		goto APP_RESET
     __endasm;
 }
 
@@ -359,9 +873,9 @@ void process_dfu_data(u8 *buffer, u16 length) {
 		if (command == SET_ADDRESS_TOKEN) {
 			dfuSubCommand = DFU_CMD_SET_ADDRESS;
 			if (length == 5) {
-				address = (u32) buffer[4] << 24 | (u32) buffer[3] << 16 | (u32) buffer[2] << 8 | (u32) buffer[1];
-				debug2("Set address to %lx\n", address);
-				if (address < ENTRY || address > FLASH_END) {
+				address = command_address(buffer);
+				debug2("Set address to %lx\n", (u32) address);
+				if (address < memory_start() || address > memory_end()) {
 					dfu_status.bState = dfuERROR;
 					dfu_status.bStatus = errADDRESS;
 				}
@@ -376,8 +890,38 @@ void process_dfu_data(u8 *buffer, u16 length) {
 				debug("Mass Erase\n");
 			} else if (length == 5) {
 				dfuSubCommand = DFU_CMD_ERASE_PAGE;
-				address = (u32) buffer[4] << 24 | (u32) buffer[3] << 16 | (u32) buffer[2] << 8 | (u32) buffer[1];
- 				debug2("Erase page at %lx\n", address);
+				address = command_address(buffer);
+ 				debug2("Erase page at %lx\n", (u32) address);
+			} else {
+				dfu_status.bState = dfuERROR;
+				dfu_status.bStatus = errSTALLEDPKT;
+			}
+		} else if (command == ERASE_RANGE_TOKEN) {
+			erase_count = buffer[5] | (u16) buffer[6] << 8;
+			// The poll timeout is limited to the size of the alternate setting
+			if (length == 7 && erase_count > 0
+					&& erase_count <= (alt_eeprom() ? EEPROM_APP_SIZE / EEPROM_PAGE_SIZE
+						: (APP_END - ENTRY + 1) / ERASE_PAGE_SIZE)) {
+				dfuSubCommand = DFU_CMD_ERASE_RANGE;
+				address = command_address(buffer);
+				debug2("Erase range at %lx\n", (u32) address);
+			} else {
+				dfu_status.bState = dfuERROR;
+				dfu_status.bStatus = errSTALLEDPKT;
+			}
+		} else if (command == PATCH_TOKEN) {
+			if (length == 5) {
+				dfuSubCommand = DFU_CMD_PATCH;
+				debug("Patch\n");
+			} else {
+				dfu_status.bState = dfuERROR;
+				dfu_status.bStatus = errSTALLEDPKT;
+			}
+		} else if (command == COMPRESSED_TOKEN) {
+			if (length == 5) {
+				dfuSubCommand = DFU_CMD_COMPRESSED;
+				address = command_address(buffer);
+				debug2("Compressed stream at %lx\n", (u32) address);
 			} else {
 				dfu_status.bState = dfuERROR;
 				dfu_status.bStatus = errSTALLEDPKT;
@@ -391,12 +935,9 @@ void process_dfu_data(u8 *buffer, u16 length) {
 			dfu_status.bStatus = errSTALLEDPKT;
 		}
 	} else if (dfuSubCommand == DFU_CMD_DOWNLOAD) {
-		int counter = 0;
+		// The block stays in DataBuffer until it is written
 		if (length <= DATA_BUFFER_SIZE) {
 			transfer_length = length;
-			for (counter = 0; counter < length; counter++) {
-				transfer[counter] = buffer[counter];
-			}
 		} else {
 			transfer_length = 0;
 			dfuSubCommand = DFU_NO_CMD;
@@ -407,56 +948,64 @@ void process_dfu_data(u8 *buffer, u16 length) {
 
 }
 
-u16 read_dfu_data(StandardRequest *request, u8 *buffer, u16 max_length) {
+/*
+ * Answer of a device to host request, data is set to the answer which is
+ * sent from there: the status needs no copy, uploads are read into
+ * DataBuffer and vendor answers are built in the IN buffer
+ */
+u16 read_dfu_data(StandardRequest *request, u8 **data) {
 	u16 length = 0;
 	debug("read dfu\n");
-	if (request->bRequest == DFU_GETSTATUS) {
-		length = 6;
-		buffer[0] = dfu_status.bStatus;
-		buffer[1] = dfu_status.bwPollTimeout0;
-		buffer[2] = dfu_status.bwPollTimeout1;
-		buffer[3] = dfu_status.bwPollTimeout2;
-		buffer[4] = dfu_status.bState;
-		buffer[5] = dfu_status.iString;
+	if (request->request_type == VENDOR) {
+		*data = (u8 __data *)InBuffer;
+		length = read_vendor_data(request, (u8 __data *)InBuffer, EP0_BUFFER_SIZE);
+	} else if (request->bRequest == DFU_GETSTATUS) {
+		*data = (u8 *) &dfu_status;
+		length = sizeof(DFU_Status);
 	} else if (request->bRequest == DFU_GETSTATE) {
+		*data = &dfu_status.bState;
 		length = 1;
-		buffer[0] = dfu_status.bState;
 	} else if (dfuSubCommand == DFU_CMD_GET_CMD) {
-		length = 3;
-		buffer[0] = GET_COMMAND_TOKEN;
-		buffer[1] = SET_ADDRESS_TOKEN;
-		buffer[2] = ERASE_PAGE_TOKEN;
+		*data = (u8 *) dfu_commands;
+		length = sizeof(dfu_commands);
 	} else if (dfuSubCommand == DFU_CMD_UPLOAD) {
-		u32 read_address;
+		flash_addr read_address;
+		flash_addr end = memory_end();
+		u16 block = request->wValue - 2;
+		u8 *buffer = (u8 __data *)DataBuffer;
 		debug("upload\n");
-		if (address < ENTRY) {
-			address = ENTRY;
+		if (address < memory_start()) {
+			address = memory_start();
 		}
-		read_address = (request->wValue - 2) * DATA_BUFFER_SIZE + address;
-		debug2("address: %lx\n", read_address);
-		if (read_address >= FLASH_END) {
+		read_address = (flash_addr) block * DATA_BUFFER_SIZE + address;
+		debug2("address: %lx\n", (u32) read_address);
+		// The block number is checked first, read_address may wrap
+		if (block > (end - address) / DATA_BUFFER_SIZE || read_address >= end) {
 			length = 0;
 			dfu_status.bState = dfuIDLE;
 		} else {
 			int counter;
 			int readed = 0;
 			length = DATA_BUFFER_SIZE;
-			if (length > max_length) {
-				length = max_length;
-			}
 			if (length > request->wLength) {
 				length = request->wLength;
 			}
-			if ((FLASH_END - read_address + 1) < length) {
-				length = FLASH_END - read_address + 1;
+			if ((end - read_address + 1) < length) {
+				length = end - read_address + 1;
+			}
+			*data = buffer;
+
+			if (alt_eeprom()) {
+				readEepromBlock(read_address - EEPROM_BASE, buffer, length);
+				return length;
 			}
 
 			counter = length;
 			while (counter > 0) {
 				if (counter >= FLASH_WRITE_SIZE) {
-					readFlash(read_address + readed, (u8 __data *)&buffer[readed], FLASH_WRITE_SIZE);
+					readFlash(read_address + readed, &buffer[readed], FLASH_WRITE_SIZE);
 				} else {
-					readFlash(read_address + readed, (u8 __data *)&buffer[readed], counter);
+					readFlash(read_address + readed, &buffer[readed], counter);
 				}
 				counter = counter - FLASH_WRITE_SIZE;
 				readed = readed + FLASH_WRITE_SIZE;
@@ -51,6 +51,14 @@ typedef enum {
 #define DFU_GETSTATE 0x05 /* 0xA1, Zero, Interface, 1, State */
 #define DFU_ABORT 0x06 /* 0x21, Zero, Interface, Zero, None */
 
+/*** Vendor bRequest Values ******/
+/* bmRequestType, wValue, wIndex, wLength, Data */
+#define VENDOR_GET_JOURNAL 0x01 /* 0xC0, Zero, Zero, 7, Journal */
+#define VENDOR_GET_PAGE_CRC 0x02 /* 0xC0, First page, Pages per CRC, 2 * CRCs, CRC list */
+#define VENDOR_GET_ERROR 0x03 /* 0xC0, Zero, Zero, 5, Status and failing address */
+#define VENDOR_GET_STATS 0x04 /* 0xC0, Age, Zero, 15, Update statistics */
+#define VENDOR_GET_BRINGUP 0x05 /* 0xC0, Zero, Zero, 14, Milestone times */
+
 /*
  * DFU status values
  */
@@ -86,7 +94,8 @@ typedef enum {
 #define dfuUPLOAD_IDLE         9
 #define dfuERROR               10
 
-extern DFU_Status dfu_status;
+extern DFU_Status __at(ACCESS_DFU_STATUS) dfu_status;
+extern flash_addr error_address;
 
 #define DFU_NO_CMD                0
 #define DFU_WAIT_CMD              1
@@ -98,20 +107,52 @@ extern DFU_Status dfu_status;
 #define DFU_CMD_MASS_ERASE        7
 #define DFU_CMD_READ_UNPROTECTED  8
 #define DFU_CMD_JUMP_APP          9
+#define DFU_CMD_PATCH            10
+#define DFU_CMD_COMPRESSED       11
+#define DFU_CMD_ERASE_RANGE      12
+
+/*
+ * Alternate settings
+ */
+#define ALT_FLASH       0
+#define ALT_EEPROM      1
+#define ALT_SETTINGS    2
+
+/*
+ * State of the image record in data EEPROM
+ */
+#define IMAGE_RECORD_NONE       0xFF // Never written, e.g. programmed by ICSP
+#define IMAGE_RECORD_VALID      0xA5 // CRC and length are valid
+#define IMAGE_RECORD_INVALID    0x00 // Update in progress or image corrupt
 
 #define GET_COMMAND_TOKEN       0x00
 #define SET_ADDRESS_TOKEN       0x21
 #define ERASE_PAGE_TOKEN        0x41
+#define ERASE_RANGE_TOKEN       0x43 /* start address (4), page count (2) */
 #define READ_UNPROTECTED_TOKEN  0x92
+#define PATCH_TOKEN             0x50 /* crc (2), length (2) of the old image */
+#define COMPRESSED_TOKEN        0x51 /* start address (4) */
 
 void init_dfu(void);
 u8 process_dfu_request(StandardRequest *request);
+u8 process_vendor_request(StandardRequest *request);
 void process_dfu_data(u8 *buffer, u16 length);
-u16 read_dfu_data(StandardRequest *request, u8 *buffer, u16 max_length);
+u16 read_dfu_data(StandardRequest *request, u8 **data);
 
 u8 dfuOperationStarted(void);
 void dfuFinishOperation(void);
 u8 dfuIsManifest(void);
 void setManifestWaitReset(void);
+void dfuManifest(void);
+void image_erase(flash_addr erase_address);
+void image_write(flash_addr write_address, u8 *buffer, u16 length);
+u8 image_program(flash_addr program_address, u8 *buffer, u16 length);
+u8 dfuCheckImage(u8 verify);
 void jump_to_app(void);
 
+#ifdef BOOT_TOP
+/* Reset vector of the image, programmed to APP_RESET at manifestation */
+extern u8 app_reset[4];
+extern u8 app_reset_pending;
+#endif
+
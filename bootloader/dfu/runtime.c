@@ -0,0 +1,78 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Runtime DFU interface, linked into applications which use the
+ * bootloader services (see runtime.h)
+ */
+
+#include <pic18fregs.h>
+
+#include "typedef.h"
+#include "services.h"
+#include "dfu/runtime.h"
+
+u16 __at(BOOT_REQUEST_ADDR) boot_request;
+
+static DFU_Status runtime_dfu_status = { OK, 0, 0, 0, appIDLE, 0 };
+
+/*
+ * Class requests to the runtime interface, the answer of GETSTATUS and
+ * GETSTATE is returned in data and length
+ */
+u8 runtime_dfu_request(StandardRequest *request, u8 **data, u16 *length) {
+	if (request->request_type != CLASS
+			|| request->recipient != RECIPIENT_INTERFACE
+			|| request->bLSBInterface != RUNTIME_DFU_INTERFACE) {
+		return FALSE;
+	}
+	switch (request->bRequest) {
+	case DFU_DETACH:
+		runtime_dfu_status.bState = appDETACH;
+		return TRUE;
+	case DFU_GETSTATUS:
+		*data = (u8 *) &runtime_dfu_status;
+		*length = sizeof(DFU_Status);
+		return TRUE;
+	case DFU_GETSTATE:
+		*data = &runtime_dfu_status.bState;
+		*length = 1;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Detach as soon as the status stage of DFU_DETACH is sent
+ */
+void runtime_dfu_task(void) {
+	if (runtime_dfu_status.bState != appDETACH || EP_IN_BD(0).Stat.UOWN) {
+		return;
+	}
+	service_close_usb();
+	boot_request = BOOT_REQUEST_MAGIC;
+	Reset();
+}
@@ -0,0 +1,61 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Runtime DFU for applications using the bootloader services
+ *
+ * Link runtime.c (built with the same RUNTIME_DFU_INTERFACE) into the
+ * application. Add RUNTIME_DFU_DESCRIPTOR to the configuration
+ * descriptor and pass class requests to runtime_dfu_request() from
+ * ApplicationData.ep0_request.
+ * runtime_dfu_task() has to be called in the main loop: after a
+ * DFU_DETACH it leaves the bus and restarts the device in the
+ * bootloader through the boot request flag, which skips the image
+ * check and the button and enumerates the bootloader at once.
+ */
+
+#include "dfu/dfu.h"
+
+#ifndef RUNTIME_DFU_INTERFACE
+#define RUNTIME_DFU_INTERFACE 0
+#endif
+
+typedef struct {
+	USB_Interface_Descriptor i;
+	DFU_Functional_Descriptor fd;
+} DFU_Runtime_Descriptor;
+
+#define RUNTIME_DFU_DESCRIPTOR(string) \
+		{ { sizeof(USB_Interface_Descriptor), INTERFACE_DESCRIPTOR, \
+				RUNTIME_DFU_INTERFACE, 0, 0, \
+				0xfe, 0x01, 0x01, /* DFU, runtime protocol */ \
+				string }, \
+		{ sizeof(DFU_Functional_Descriptor), DFU_INTERFACE_DESCRIPTOR, \
+				0x0b, /* bitCanDnload | bitCanUpload | willDetach */ \
+				0x00ff, DATA_BUFFER_SIZE, 0x011a } }
+
+u8 runtime_dfu_request(StandardRequest *request, u8 **data, u16 *length);
+void runtime_dfu_task(void);
@@ -0,0 +1,288 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *         Based on LeafLabs LLC.'s Maple Bootloader
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Stream decoders, the decoded data is collected in a page buffer
+ * which is erased and programmed page by page in address order
+ */
+
+#include "typedef.h"
+#include "debug.h"
+#include "config.h"
+#include "usb/usb_std_req.h"
+#include "dfu/dfu.h"
+#include "dfu/stream.h"
+#include "flash.h"
+
+/* Decoder states */
+#define OP_NEXT         0
+#define OP_LITERAL      1
+#define OP_ARG_LOW      2
+#define OP_ARG_HIGH     3
+
+u8 stream_mode = STREAM_NONE;
+flash_addr stream_start;
+u8 page[ERASE_PAGE_SIZE];
+flash_addr page_base;
+u8 page_pos;
+u8 page_dirty;
+u8 op;
+u8 op_state;
+u8 op_count;
+u16 op_arg;
+
+/*
+ * Load the old content of the page containing out_address
+ */
+u8 page_load(flash_addr out_address) {
+	if (out_address < ENTRY || out_address > APP_END) {
+		return errADDRESS;
+	}
+	page_base = out_address & ~((flash_addr) ERASE_PAGE_SIZE - 1);
+	page_pos = out_address - page_base;
+	page_dirty = FALSE;
+	readFlash(page_base, page, ERASE_PAGE_SIZE);
+	return OK;
+}
+
+/*
+ * Program the page buffer, unchanged pages are not touched
+ */
+u8 page_flush(void) {
+	u8 old[FLASH_WRITE_SIZE];
+	u8 changed = FALSE;
+	u8 offset;
+	u8 counter;
+
+	page_dirty = FALSE;
+	for (offset = 0; offset < ERASE_PAGE_SIZE; offset += FLASH_WRITE_SIZE) {
+		readFlash(page_base + offset, old, FLASH_WRITE_SIZE);
+		for (counter = 0; counter < FLASH_WRITE_SIZE; counter++) {
+			if (old[counter] != page[offset + counter]) {
+				changed = TRUE;
+			}
+		}
+	}
+
+	if (changed) {
+		debug2("patch page: %lx\n", page_base);
+		image_erase(page_base);
+		return image_program(page_base, page, ERASE_PAGE_SIZE);
+	}
+	image_write(page_base, page, ERASE_PAGE_SIZE);
+	return OK;
+}
+
+u8 page_put(u8 data) {
+	page[page_pos++] = data;
+	page_dirty = TRUE;
+	if (page_pos == ERASE_PAGE_SIZE) {
+		u8 status = page_flush();
+		if (status != OK) {
+			return status;
+		}
+		if (page_base + ERASE_PAGE_SIZE > APP_END) {
+			// Only an error if more data follows
+			page_pos = 0;
+			page_base += ERASE_PAGE_SIZE;
+			return OK;
+		}
+		return page_load(page_base + ERASE_PAGE_SIZE);
+	}
+	return OK;
+}
+
+/*
+ * Copy from old flash, pages below the page buffer are overwritten
+ */
+u8 patch_copy(flash_addr source, u8 length) {
+	u8 data;
+	u8 status;
+
+	while (length--) {
+		if (source < page_base || source > APP_END) {
+			return errFILE;
+		}
+		readFlash(source, &data, 1);
+		source++;
+		status = page_put(data);
+		if (status != OK) {
+			return status;
+		}
+	}
+	return OK;
+}
+
+u8 patch_seek(flash_addr out_address) {
+	if (out_address < page_base + page_pos) {
+		return errFILE;
+	}
+	if (page_dirty) {
+		u8 status = page_flush();
+		if (status != OK) {
+			return status;
+		}
+	}
+	return page_load(out_address);
+}
+
+u8 lz_match(u16 distance, u8 length) {
+	flash_addr source;
+	u8 data;
+	u8 status;
+
+	if (page_base + page_pos - stream_start < distance) {
+		return errFILE;
+	}
+	source = page_base + page_pos - distance;
+
+	while (length--) {
+		if (source >= page_base) {
+			data = page[source - page_base];
+		} else {
+			// Already programmed by this stream
+			readFlash(source, &data, 1);
+#ifdef BOOT_TOP
+			// Flash holds the boot vector where the image has its reset vector
+			if (source < ENTRY + 4 && app_reset_pending) {
+				data = app_reset[source - ENTRY];
+			}
+#endif
+		}
+		source++;
+		status = page_put(data);
+		if (status != OK) {
+			return status;
+		}
+	}
+	return OK;
+}
+
+u8 lz_op(void) {
+	u8 length = (op & 0x3F) + LZ_MIN_LENGTH;
+	u8 status;
+
+	if (op >= LZ_MATCH) {
+		return lz_match(op_arg + 1, length);
+	}
+	while (length--) {
+		status = page_put(op_arg);
+		if (status != OK) {
+			return status;
+		}
+	}
+	return OK;
+}
+
+u8 stream_byte(u8 data) {
+	if (page_base > APP_END) {
+		return errADDRESS;
+	}
+
+	if (op_state == OP_NEXT) {
+		op = data;
+		if (op < PATCH_COPY) {
+			op_count = op + 1;
+			op_state = OP_LITERAL;
+		} else {
+			op_state = OP_ARG_LOW;
+		}
+	} else if (op_state == OP_LITERAL) {
+		if (--op_count == 0) {
+			op_state = OP_NEXT;
+		}
+		return page_put(data);
+	} else if (op_state == OP_ARG_LOW) {
+		op_arg = data;
+		if (stream_mode == STREAM_LZ) {
+			op_state = OP_NEXT;
+			return lz_op();
+		}
+		op_state = OP_ARG_HIGH;
+	} else {
+		op_arg |= (u16) data << 8;
+		op_state = OP_NEXT;
+		if (op == PATCH_SEEK) {
+			return patch_seek(ENTRY + op_arg);
+		}
+		return patch_copy(ENTRY + op_arg, op - (PATCH_COPY - 1));
+	}
+	return OK;
+}
+
+u8 stream_begin(u8 mode, flash_addr start) {
+	// A new element of a compressed image ends the previous one
+	if (stream_mode != STREAM_NONE && page_dirty) {
+		u8 status = page_flush();
+		if (status != OK) {
+			stream_mode = STREAM_NONE;
+			return status;
+		}
+	}
+	stream_mode = mode;
+	stream_start = start;
+	op_state = OP_NEXT;
+	return page_load(start);
+}
+
+u8 stream_active(void) {
+	return stream_mode != STREAM_NONE;
+}
+
+u8 stream_data(u8 *buffer, u16 length) {
+	u8 status = OK;
+
+	while (length-- && status == OK) {
+		status = stream_byte(*buffer);
+		buffer++;
+	}
+	if (status != OK) {
+		stream_abort();
+	}
+	return status;
+}
+
+u8 stream_end(void) {
+	stream_mode = STREAM_NONE;
+	if (op_state != OP_NEXT) {
+		return errNOTDONE;
+	}
+	if (page_dirty) {
+		return page_flush();
+	}
+	return OK;
+}
+
+/*
+ * Drop the stream, a page which was not flushed yet is not programmed
+ */
+void stream_abort(void) {
+	stream_mode = STREAM_NONE;
+	page_dirty = FALSE;
+	op_state = OP_NEXT;
+}
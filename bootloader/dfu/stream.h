@@ -0,0 +1,75 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *         Based on LeafLabs LLC.'s Maple Bootloader
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Stream modes
+ */
+#define STREAM_NONE     0
+#define STREAM_PATCH    1
+#define STREAM_LZ       2
+
+/*
+ * Patch operations
+ *
+ * 0x00 - 0x7F: LITERAL, op + 1 bytes follow
+ * 0x80 - 0xFE: COPY op - 0x7F bytes from old flash, offset (2 bytes)
+ *              relative to ENTRY follows
+ * 0xFF:        SEEK output to offset (2 bytes) relative to ENTRY,
+ *              pages in between are not touched
+ *
+ * The output starts at ENTRY and is written page by page in address
+ * order. COPY may only read pages which were not written yet.
+ */
+#define PATCH_LITERAL   0x00
+#define PATCH_COPY      0x80
+#define PATCH_SEEK      0xFF
+
+/*
+ * Compressed stream operations
+ *
+ * 0x00 - 0x7F: LITERAL, op + 1 bytes follow
+ * 0x80 - 0xBF: RUN, (op & 0x3F) + 3 times the following byte
+ * 0xC0 - 0xFF: MATCH, (op & 0x3F) + 3 bytes from the output, the
+ *              following byte is the distance - 1
+ *
+ * Matches are read from the page buffer or from the pages which were
+ * already programmed by this stream.
+ */
+#define LZ_LITERAL      0x00
+#define LZ_RUN          0x80
+#define LZ_MATCH        0xC0
+#define LZ_MIN_LENGTH   3
+
+/* Page buffer of the stream, free for other users while no stream is active */
+extern u8 page[ERASE_PAGE_SIZE];
+
+u8 stream_begin(u8 mode, flash_addr start);
+u8 stream_active(void);
+u8 stream_data(u8 *buffer, u16 length);
+u8 stream_end(void);
+void stream_abort(void);
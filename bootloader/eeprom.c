@@ -0,0 +1,91 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <pic18fregs.h>
+#include "typedef.h"
+#include "eeprom.h"
+
+u8 readEeprom(u8 address) {
+	EEADR = address;
+
+	/*
+	 * bit 7, EEPGD = 0, memory is data EEPROM
+	 * bit 6, CFGS  = 0, enable acces to EEPROM
+	 */
+	EECON1bits.EEPGD = 0;
+	EECON1bits.CFGS = 0;
+	EECON1bits.RD = 1;
+
+	return EEDATA;
+}
+
+void writeEeprom(u8 address, u8 data) {
+	u8 gie;
+
+	// Skip the write cycle if the cell already holds the value
+	if (readEeprom(address) == data) {
+		return;
+	}
+
+	EEADR = address;
+	EEDATA = data;
+
+	EECON1bits.EEPGD = 0;
+	EECON1bits.CFGS = 0;
+	EECON1bits.WREN = 1;
+
+	gie = INTCONbits.GIE;
+	INTCONbits.GIE = 0;
+
+	EECON2 = 0x55;
+	EECON2 = 0xAA;
+	EECON1bits.WR = 1;      // CPU continues, WR is cleared by hardware
+
+	// The bootloader runs with interrupts disabled, the vectors may
+	// belong to the application
+	INTCONbits.GIE = gie;
+
+	while (EECON1bits.WR);
+	PIR2bits.EEIF = 0;
+	EECON1bits.WREN = 0;
+}
+
+void readEepromBlock(u8 address, u8 *buffer, u8 length) {
+	u8 counter;
+
+	for (counter = 0; counter < length; counter++) {
+		buffer[counter] = readEeprom(address + counter);
+	}
+}
+
+void writeEepromBlock(u8 address, u8 *buffer, u8 length) {
+	u8 counter;
+
+	for (counter = 0; counter < length; counter++) {
+		writeEeprom(address + counter, buffer[counter]);
+	}
+}
+
+void fillEeprom(u8 address, u8 data, u8 length) {
+	u8 counter;
+
+	for (counter = 0; counter < length; counter++) {
+		writeEeprom(address + counter, data);
+	}
+}
@@ -25,13 +25,25 @@
 #include "typedef.h"
 #include "flash.h"
 
-void eraseFlash(u32 address) {
+/*
+ * With 16 bit flash addresses TBLPTRU stays 0, it is cleared at start
+ */
+#ifdef FLASH_ADDR_16
+#define SET_TBLPTR(address) \
+	TBLPTRL = LOWB(address); \
+	TBLPTRH = HIGHB(address);
+#else
+#define SET_TBLPTR(address) \
+	TBLPTRL = (address) & 0xFF; \
+	TBLPTRH = (address >> 8) & 0xFF; \
+	TBLPTRU = (address >> 16) & 0xFF;
+#endif
+
+void eraseFlash(flash_addr address) {
 
     PIR2bits.EEIF = 0;
 
-	TBLPTRL = (address) & 0xFF;
-	TBLPTRH = (address >> 8) & 0xFF;
-	TBLPTRU = (address >> 16) & 0xFF;
+	SET_TBLPTR(address);
 
     /*
      * bit 7, EEPGD = 1, memory is flash (unimplemented on J PIC)
@@ -57,13 +69,11 @@ void eraseFlash(u32 address) {
     EECON1bits.WREN = 0;
 }
 
-void readFlash(u32 address, u8 *buffer, u8 length) {
+void readFlash(flash_addr address, u8 *buffer, u8 length) {
 
 	int counter;
 
-	TBLPTRL = (address) & 0xFF;
-	TBLPTRH = (address >> 8) & 0xFF;
-	TBLPTRU = (address >> 16) & 0xFF;
+	SET_TBLPTR(address);
 
 
 	/*
@@ -93,15 +103,14 @@ void readFlash(u32 address, u8 *buffer, u8 length) {
 
 }
 
-void writeFlash(u32 address, u8 *buffer, u8 length) {
+void writeFlash(flash_addr address, u8 *buffer, u8 length) {
 
 	int counter;
+	u8 gie = INTCONbits.GIE;
 
     PIR2bits.EEIF = 0;
 
-	TBLPTRL = (address) & 0xFF;
-	TBLPTRH = (address >> 8) & 0xFF;
-	TBLPTRU = (address >> 16) & 0xFF;
+	SET_TBLPTR(address);
 
     /*
      * bit 7, EEPGD = 1, memory is flash (unimplemented on J PIC)
@@ -147,10 +156,75 @@ void writeFlash(u32 address, u8 *buffer, u8 length) {
                             // of the write or erase operation.
                             // CPU stall here for 2ms
 
-    INTCONbits.GIE = 1;
+    // The bootloader runs with interrupts disabled, the vectors may
+    // belong to the application
+    INTCONbits.GIE = gie;
 
     while (!PIR2bits.EEIF);
     PIR2bits.EEIF = 0;
     EECON1bits.WREN = 0;
 
 }
+
+/*
+ * Compare flash with the buffer, returns the number of equal bytes
+ * before the first difference
+ */
+u8 verifyFlash(flash_addr address, u8 *buffer, u8 length) {
+	u8 counter;
+
+	SET_TBLPTR(address);
+
+	for (counter = 0; counter < length; counter++) {
+        // TBLPTR is incremented after the read
+        __asm
+        	TBLRD*+
+        __endasm;
+		if (TABLAT != buffer[counter]) {
+			break;
+		}
+	}
+
+	return counter;
+}
+
+/*
+ * CRC-16/CCITT (polynomial 0x1021, MSB first), calculated bytewise
+ * on the two CRC bytes to avoid 16 bit shifts and a lookup table
+ */
+#define CRC_UPDATE(hi, lo, x, data) \
+	x = hi ^ (data); \
+	x ^= x >> 4; \
+	hi = lo ^ (x << 4) ^ (x >> 3); \
+	lo = (x << 5) ^ x;
+
+u16 crcBuffer(u8 *buffer, u16 length, u16 crc) {
+	u8 hi = HIGHB(crc);
+	u8 lo = LOWB(crc);
+	u8 x;
+
+	while (length--) {
+		CRC_UPDATE(hi, lo, x, *buffer);
+		buffer++;
+	}
+
+	return ((u16) hi << 8) | lo;
+}
+
+u16 crcFlash(flash_addr address, u16 length, u16 crc) {
+	u8 hi = HIGHB(crc);
+	u8 lo = LOWB(crc);
+	u8 x;
+
+	SET_TBLPTR(address);
+
+	while (length--) {
+        // TBLPTR is incremented after the read
+        __asm
+        	TBLRD*+
+        __endasm;
+		CRC_UPDATE(hi, lo, x, TABLAT);
+	}
+
+	return ((u16) hi << 8) | lo;
+}
@@ -17,8 +17,12 @@
  * License along with this library.
  */
 
-#define FLASH_WRITE_SIZE 32
+#include "mcu.h"
 
-void eraseFlash(u32 address);
-void readFlash(u32 address, u8 *buffer, u8 length);
-void writeFlash(u32 address, u8 *buffer, u8 length);
+void eraseFlash(flash_addr address);
+void readFlash(flash_addr address, u8 *buffer, u8 length);
+void writeFlash(flash_addr address, u8 *buffer, u8 length);
+u8 verifyFlash(flash_addr address, u8 *buffer, u8 length);
+
+u16 crcBuffer(u8 *buffer, u16 length, u16 crc);
+u16 crcFlash(flash_addr address, u16 length, u16 crc);
@@ -17,6 +17,18 @@
  * License along with this library.
  */
 
+#if defined(MCU_18f25k50) || defined(MCU_18f45k50)
+
+/* 16 MHz crystal, 3x PLL for USB and 48 MHz CPU clock */
+#pragma config PLLSEL = PLL3X, CFGPLLEN = ON, CPUDIV = NOCLKDIV, LS48MHZ = SYS48X8
+#pragma config FOSC = HSH, PCLKEN = ON, FCMEN = OFF, IESO = OFF
+#pragma config nPWRTEN = ON, BOREN = SBORDIS, BORV = 285, nLPBOR = OFF
+#pragma config WDTEN = OFF
+#pragma config PBADEN = OFF, MCLRE = ON
+#pragma config STVREN = ON, LVP = OFF, XINST = OFF
+
+#else
+
 static __code char __at(__CONFIG1H) conf1H = _OSC_HS__HS_PLL__USB_HS_1H & _FCMEN_OFF_1H & _IESO_ON_1H;
 static __code char __at(__CONFIG1L) conf1L = _USBPLL_CLOCK_SRC_FROM_96MHZ_PLL_2_1L & _CPUDIV__OSC1_OSC2_SRC___1__96MHZ_PLL_SRC___2__1L &_PLLDIV_DIVIDE_BY_5__20MHZ_INPUT__1L;
 static __code char __at(__CONFIG2H) conf2H = _WDT_DISABLED_CONTROLLED_2H;
@@ -30,3 +42,5 @@ static __code char __at(__CONFIG6L) conf6L = _WRT_0_OFF_6L & _WRT_1_OFF_6L & _WR
 static __code char __at(__CONFIG6H) conf6H = _WRTD_OFF_6H & _WRTB_OFF_6H & _WRTC_OFF_6H;
 static __code char __at(__CONFIG7L) conf7L = _EBTR_0_OFF_7L & _EBTR_1_OFF_7L & _EBTR_2_OFF_7L & _EBTR_3_OFF_7L;
 static __code char __at(__CONFIG7H) conf7H = _EBTRB_OFF_7H;
+
+#endif
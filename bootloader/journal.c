@@ -0,0 +1,109 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Progress journal of a download in data EEPROM
+ *
+ * Every entry holds the first uncommitted address and the CRC of the
+ * image up to this address. The entries are written round robin into
+ * JOURNAL_SLOTS slots to spread the wear, the newest entry is the one
+ * which is not followed by its successor.
+ *
+ * Slot: offset (2), crc (2), sequence (1), check (1)
+ */
+
+#include "typedef.h"
+#include "config.h"
+#include "eeprom.h"
+#include "journal.h"
+
+#define JOURNAL_SLOT_SIZE 6
+
+static u8 slot[JOURNAL_SLOT_SIZE];
+
+static u8 journal_check(void) {
+	return slot[0] ^ slot[1] ^ slot[2] ^ slot[3] ^ slot[4] ^ 0x5A;
+}
+
+static u8 journal_load(u8 index) {
+	readEepromBlock(EEPROM_JOURNAL + index * JOURNAL_SLOT_SIZE, slot, JOURNAL_SLOT_SIZE);
+	return slot[5] == journal_check();
+}
+
+/*
+ * Find the newest entry, returns JOURNAL_SLOTS if there is none
+ */
+static u8 journal_newest(void) {
+	u8 index;
+	u8 next;
+	u8 seq;
+
+	for (index = 0; index < JOURNAL_SLOTS; index++) {
+		if (!journal_load(index)) {
+			continue;
+		}
+		seq = slot[4];
+		next = index + 1;
+		if (next == JOURNAL_SLOTS) {
+			next = 0;
+		}
+		if (!journal_load(next) || slot[4] != (u8) (seq + 1)) {
+			journal_load(index);
+			return index;
+		}
+	}
+	return JOURNAL_SLOTS;
+}
+
+void journal_commit(flash_addr address, u16 crc) {
+	u8 index;
+	u8 seq = 0;
+
+	index = journal_newest();
+	if (index == JOURNAL_SLOTS) {
+		index = 0;
+	} else {
+		seq = slot[4] + 1;
+		index++;
+		if (index == JOURNAL_SLOTS) {
+			index = 0;
+		}
+	}
+
+	address -= ENTRY;
+	slot[0] = LOWB(address);
+	slot[1] = HIGHB(address);
+	slot[2] = LOWB(crc);
+	slot[3] = HIGHB(crc);
+	slot[4] = seq;
+	slot[5] = journal_check();
+
+	writeEepromBlock(EEPROM_JOURNAL + index * JOURNAL_SLOT_SIZE, slot, JOURNAL_SLOT_SIZE);
+}
+
+u8 journal_read(flash_addr *address, u16 *crc) {
+	if (journal_newest() == JOURNAL_SLOTS) {
+		*address = ENTRY;
+		*crc = 0xFFFF;
+		return FALSE;
+	}
+	*address = ENTRY + (slot[0] | (u16) slot[1] << 8);
+	*crc = slot[2] | (u16) slot[3] << 8;
+	return TRUE;
+}
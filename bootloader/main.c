@@ -32,20 +32,80 @@
 #include "usb/usb_std_req.h"
 #include "usb/usb.h"
 #include "dfu/dfu.h"
+#include "flash.h"
 #include "led.h"
+#include "stats.h"
+#include "bringup.h"
 
 #pragma stack 0x200 255
 
-void main(void) {
+u16 __at(BOOT_REQUEST_ADDR) boot_request;
+
+/*
+ * Check if the reset vector of the application is programmed
+ */
+u8 app_present(void) {
+	u8 vector[2];
+
+	readFlash(APP_RESET, vector, 2);
+	if (vector[0] == 0xFF && vector[1] == 0xFF) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Boot decision, runs before any peripheral is touched
+ */
+u8 stay_in_bootloader(void) {
 
-	u16 reset_timeout = 0;
 	/*
-	 * Initialize Ports
+	 * Update mode requested by a RESET instruction, the flag is only
+	 * trusted if RAM was not lost by a power on reset
+	 */
+	if (RCONbits.RI == 0 && RCONbits.POR == 1
+			&& boot_request == BOOT_REQUEST_MAGIC) {
+		boot_request = 0;
+		return TRUE;
+	}
+
+	/*
+	 * No application or half erased application
 	 */
+	if (!app_present()) {
+		return TRUE;
+	}
 
+	/*
+	 * Check the image record. The bootloader invalidates it before it
+	 * changes flash and writes it after the CRC check at manifestation.
+	 * With BOOT_VERIFY_CRC the CRC is also calculated after power on
+	 * and brown-out resets.
+	 */
+#ifdef BOOT_VERIFY_CRC
+	if (!dfuCheckImage(RCONbits.POR == 0 || RCONbits.BOR == 0)) {
+#else
+	if (!dfuCheckImage(FALSE)) {
+#endif
+		return TRUE;
+	}
+
+	/*
+	 * Check if button is pressed
+	 */
+#ifdef BUTTON_PORT
 	BUTTON_TRIS = 1;
-	led_init();
-	led_off();
+	if ((BUTTON_PORT & (1<<BUTTON_PIN)) == 0) {
+		return TRUE;
+	}
+#endif
+
+	return FALSE;
+}
+
+void main(void) {
+
+	u16 reset_timeout = 0;
 
 #ifdef _DEBUG
 	TRISCbits.TRISC6 = 0; //TX pin set as output
@@ -60,17 +120,23 @@ void main(void) {
 	debug("Serial interface started\n");
 #endif
 
+#ifdef FLASH_ADDR_16
+	// The flash routines only set the lower bytes of TBLPTR
+	TBLPTRU = 0;
+#endif
+
 	/*
-	 * Check if button is pressed
+	 * Fast path, start the application without USB bring-up
 	 */
-#ifdef BUTTON_PORT
-	if ((BUTTON_PORT & (1<<BUTTON_PIN)) > 0) {
+	bringup_start();
+	if (!stay_in_bootloader()) {
 		jump_to_app();
 	}
-#endif
+	bringup_mark(BRINGUP_DECIDED);
 
 	/*
-	 * Configure USB and DFU
+	 * Configure USB and attach first, the host waits at least 100 ms
+	 * before the bus reset, the rest of the bring-up runs meanwhile
 	 */
 	debug("Configure usb descriptors\n");
 	device_descriptor = &boot_device_descriptor;
@@ -81,10 +147,23 @@ void main(void) {
 	ep_in = boot_ep_in;
 	ep_out = boot_ep_out;
 	ep_setup = boot_ep_setup;
+	application_data = 0;
 
 	init_usb();
+	enable_usb();
 	debug("USB interface started\n");
 
+	/*
+	 * Reset all reset flags, so the next reset cause can be detected
+	 */
+	RCON |= 0x13;
+
+	/*
+	 * Initialize Ports
+	 */
+	led_init();
+	led_off();
+
 	init_dfu();
 
 	/*
@@ -92,11 +171,14 @@ void main(void) {
 	 */
 	led_on();
 	while (1) {
-		enable_usb();
 		dispatch_usb_event();
+		stats_tick();
 		if (dfuOperationStarted()) {
 			dfuFinishOperation();
 		}
+		if (dfuIsManifest() && reset_timeout == 0) {
+			dfuManifest();
+		}
 		if (dfuIsManifest()) {
 			reset_timeout++;
 		}
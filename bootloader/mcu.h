@@ -0,0 +1,66 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Flash geometry of the supported parts, selected with MCU in the Makefile
+ *
+ * FLASH_END            last address of the program memory
+ * FLASH_WRITE_SIZE     bytes programmed at once (holding registers)
+ * ERASE_PAGE_SIZE      bytes erased at once
+ * TRANSFER_SIZE        EP0 packet size, the DFU wTransferSize is one
+ *                      erase page received in one or two packets
+ * FLASH_LAYOUT_PAGES   number of erase pages of the application as
+ *                      UTF-16 digits for the DfuSe layout string
+ */
+#if defined(MCU_18f2455) || defined(MCU_18f4455) || defined(MCU_18f2458) || defined(MCU_18f4458)
+#define FLASH_END 0x5FFF
+#define FLASH_WRITE_SIZE 32
+#define ERASE_PAGE_SIZE 64
+#define TRANSFER_SIZE 32
+#define FLASH_LAYOUT_PAGES '1',0x00,'2',0x00,'8',0x00
+#elif defined(MCU_18f2550) || defined(MCU_18f4550) || defined(MCU_18f2553) || defined(MCU_18f4553)
+#define FLASH_END 0x7FFF
+#define FLASH_WRITE_SIZE 32
+#define ERASE_PAGE_SIZE 64
+#define TRANSFER_SIZE 32
+#define FLASH_LAYOUT_PAGES '2',0x00,'5',0x00,'6',0x00
+#elif defined(MCU_18f25k50) || defined(MCU_18f45k50)
+#define FLASH_END 0x7FFF
+#define FLASH_WRITE_SIZE 64
+#define ERASE_PAGE_SIZE 64
+#define TRANSFER_SIZE 64
+#define FLASH_LAYOUT_PAGES '2',0x00,'5',0x00,'6',0x00
+#else
+#error "No flash geometry for this MCU, see mcu.h"
+#endif
+
+/*
+ * Type of a flash address, 16 bit math and no TBLPTRU updates if the
+ * flash and the EEPROM window (EEPROM_BASE) fit into 64 KB
+ */
+#if FLASH_END < 0xF000
+#define FLASH_ADDR_16
+#define flash_addr u16
+#else
+#define flash_addr u32
+#endif
+
+#if defined(BOOT_TOP) && FLASH_END != 0x7FFF
+#error "LAYOUT=top needs a part with 32 KB flash"
+#endif
@@ -0,0 +1,67 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <pic18fregs.h>
+
+#include "config.h"
+#include "services.h"
+
+/*
+ * Service table, the order and the address (SERVICE_TABLE) are fixed
+ * for applications, new entries are only appended
+ */
+#ifdef BOOT_TOP
+#pragma code service_table 0x7FC0
+#else
+#pragma code service_table 0x3FC0
+#endif
+
+void service_table(void) __naked {
+	__asm
+		extern _usb_register
+		extern _init_usb
+		extern _enable_usb
+		extern _dispatch_usb_event
+		extern _close_usb
+		extern _fill_in_buffer
+		extern _ep0_init
+		extern _ep0_in
+		extern _ep0_out
+		extern _ep0_setup
+		extern _readFlash
+		extern _writeFlash
+		extern _eraseFlash
+
+		retlw SERVICE_VERSION
+		nop
+		goto _usb_register
+		goto _init_usb
+		goto _enable_usb
+		goto _dispatch_usb_event
+		goto _close_usb
+		goto _fill_in_buffer
+		goto _ep0_init
+		goto _ep0_in
+		goto _ep0_out
+		goto _ep0_setup
+		goto _readFlash
+		goto _writeFlash
+		goto _eraseFlash
+	__endasm;
+}
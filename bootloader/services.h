@@ -0,0 +1,80 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Bootloader services
+ *
+ * The bootloader exports its USB stack and the flash routines through a
+ * table of gotos at SERVICE_TABLE, so an application does not need its
+ * own copy. Build the application with -I<bootloader> -DMCU_<mcu> (and
+ * -DBOOT_TOP for LAYOUT=top) and the same SDCC version as the
+ * bootloader.
+ *
+ * The services use the RAM of the bootloader: an application must not
+ * allocate gpr1, gpr3, usb4, usb5 (0x100-0x1FF, 0x300-0x5FF) and the
+ * access RAM from ACCESS_STATE_START, the software stack in gpr2 is
+ * shared. Endpoint buffers of the application
+ * belong into usb6 or usb7, the linker scripts of the bootloader
+ * protect these banks and gpr2. The services are not reentrant, call
+ * them from the main loop only.
+ *
+ * Usage:
+ *	service_usb_register(&application);
+ *	service_init_usb();
+ *	service_enable_usb();
+ *	while (1) {
+ *		service_dispatch_usb_event();
+ *	}
+ *
+ * The flash services take a flash_addr (16 bit on parts with up to
+ * 60 KB of flash) and expect TBLPTRU to be 0 then.
+ *
+ * The endpoint 0 entries of the application tables are the
+ * service_ep0_* functions, class and vendor requests on endpoint 0 are
+ * passed to ApplicationData.ep0_request. A bus reset only calls entry 0
+ * of the ep_init table of configuration 0.
+ */
+
+#include "typedef.h"
+#include "usb/usb_descriptors.h"
+#include "usb/usb_std_req.h"
+#include "usb/usb.h"
+
+#define SERVICE_VERSION 2
+
+#ifdef BOOT_TOP
+#define SERVICE_TABLE 0x7FC0
+#else
+#define SERVICE_TABLE 0x3FC0
+#endif
+
+#define service_version            ((u8 (*)(void)) (SERVICE_TABLE + 0x00))
+#define service_usb_register       ((void (*)(const ApplicationData *)) (SERVICE_TABLE + 0x04))
+#define service_init_usb           ((void (*)(void)) (SERVICE_TABLE + 0x08))
+#define service_enable_usb         ((void (*)(void)) (SERVICE_TABLE + 0x0C))
+#define service_dispatch_usb_event ((void (*)(void)) (SERVICE_TABLE + 0x10))
+#define service_close_usb          ((void (*)(void)) (SERVICE_TABLE + 0x14))
+#define service_fill_in_buffer     ((void (*)(u8, u8 **, u16, u16 *)) (SERVICE_TABLE + 0x18))
+#define service_ep0_init           ((void (*)(void)) (SERVICE_TABLE + 0x1C))
+#define service_ep0_in             ((void (*)(void)) (SERVICE_TABLE + 0x20))
+#define service_ep0_out            ((void (*)(void)) (SERVICE_TABLE + 0x24))
+#define service_ep0_setup          ((void (*)(void)) (SERVICE_TABLE + 0x28))
+#define service_readFlash          ((void (*)(flash_addr, u8 *, u8)) (SERVICE_TABLE + 0x2C))
+#define service_writeFlash         ((void (*)(flash_addr, u8 *, u8)) (SERVICE_TABLE + 0x30))
+#define service_eraseFlash         ((void (*)(flash_addr)) (SERVICE_TABLE + 0x34))
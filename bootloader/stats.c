@@ -0,0 +1,190 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Update statistics in data EEPROM, see stats.h
+ *
+ * The elapsed time is counted with the USB frame number, which the SIE
+ * increments with every SOF (1 ms). stats_tick runs in the main loop,
+ * no operation blocks it for the 2048 ms of a frame number period.
+ */
+
+#include <pic18fregs.h>
+#include "typedef.h"
+#include "config.h"
+#include "eeprom.h"
+#include "usb/usb_std_req.h"
+#include "dfu/dfu.h"
+#include "stats.h"
+
+#define STATS_SLOT_SIZE 16
+#define FRAME_MASK      0x7FF
+
+StatsRecord stats;
+
+static StatsRecord slot;
+static u8 stats_index;
+static u8 stats_active = FALSE;
+static u16 stats_frame;
+
+static u8 stats_check(StatsRecord *record) {
+	u8 *data = (u8 *) record;
+	u8 check = 0x5A;
+	u8 i;
+
+	for (i = 0; i < STATS_RECORD_SIZE; i++) {
+		check ^= data[i];
+	}
+	return check;
+}
+
+static u8 stats_load(u8 index) {
+	u8 address = EEPROM_STATS + index * STATS_SLOT_SIZE;
+
+	readEepromBlock(address, (u8 *) &slot, STATS_RECORD_SIZE);
+	return readEeprom(address + STATS_RECORD_SIZE) == stats_check(&slot);
+}
+
+/*
+ * Find the newest record, returns STATS_SLOTS if there is none
+ */
+static u8 stats_newest(void) {
+	u8 index;
+	u8 next;
+	u16 session;
+
+	for (index = 0; index < STATS_SLOTS; index++) {
+		if (!stats_load(index)) {
+			continue;
+		}
+		session = slot.session;
+		next = index + 1;
+		if (next == STATS_SLOTS) {
+			next = 0;
+		}
+		if (!stats_load(next) || slot.session != (u16) (session + 1)) {
+			stats_load(index);
+			return index;
+		}
+	}
+	return STATS_SLOTS;
+}
+
+static void stats_commit(void) {
+	u8 address = EEPROM_STATS + stats_index * STATS_SLOT_SIZE;
+
+	writeEepromBlock(address, (u8 *) &stats, STATS_RECORD_SIZE);
+	writeEeprom(address + STATS_RECORD_SIZE, stats_check(&stats));
+}
+
+static u16 stats_frame_number(void) {
+	return UFRML | (u16) (UFRMH & 0x07) << 8;
+}
+
+/*
+ * Called with the first change of the image
+ */
+void stats_begin(void) {
+	u8 index = stats_newest();
+
+	stats.interrupted = 0;
+	stats.session = 0;
+	if (index == STATS_SLOTS) {
+		index = 0;
+	} else {
+		stats.interrupted = slot.interrupted;
+		if ((slot.flags & STATS_OPEN) && stats.interrupted < 0xFF) {
+			stats.interrupted++;
+		}
+		stats.session = slot.session + 1;
+		index++;
+		if (index == STATS_SLOTS) {
+			index = 0;
+		}
+	}
+
+	stats_index = index;
+	stats.written = 0;
+	stats.erased = 0;
+	stats.elapsed = 0;
+	stats.error = OK;
+	stats.flags = STATS_OPEN;
+	stats_frame = stats_frame_number();
+	stats_active = TRUE;
+	stats_commit();
+}
+
+void stats_tick(void) {
+	u16 frame;
+
+	if (!stats_active) {
+		return;
+	}
+	frame = stats_frame_number();
+	stats.elapsed += (frame - stats_frame) & FRAME_MASK;
+	stats_frame = frame;
+
+	// Written at once, the session may never be manifested
+	if (dfu_status.bStatus != OK && dfu_status.bStatus != stats.error) {
+		stats.error = dfu_status.bStatus;
+		stats_commit();
+	}
+}
+
+/*
+ * Called when the image is manifested
+ */
+void stats_end(void) {
+	if (!stats_active) {
+		return;
+	}
+	stats_tick();
+	stats.flags &= ~STATS_OPEN;
+	stats_commit();
+	stats_active = FALSE;
+}
+
+/*
+ * Copy a record to the buffer, age 0 is the newest (the running
+ * session), returns the length or 0 if there is no such record
+ */
+u8 stats_read(u8 age, u8 *buffer) {
+	u8 index = stats_newest();
+	u16 session = slot.session;
+	u8 *data = (u8 *) &slot;
+	u8 i;
+
+	if (index == STATS_SLOTS || age >= STATS_SLOTS) {
+		return 0;
+	}
+	while (age--) {
+		index = index == 0 ? STATS_SLOTS - 1 : index - 1;
+		session--;
+		if (!stats_load(index) || slot.session != session) {
+			return 0;
+		}
+	}
+	if (stats_active && session == stats.session) {
+		data = (u8 *) &stats;
+	}
+	for (i = 0; i < STATS_RECORD_SIZE; i++) {
+		buffer[i] = data[i];
+	}
+	return STATS_RECORD_SIZE;
+}
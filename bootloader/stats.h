@@ -0,0 +1,49 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Update statistics, one record per update session
+ *
+ * A session starts with the first change of the image and ends when
+ * the image is manifested. The records are written round robin into
+ * STATS_SLOTS slots of data EEPROM like the journal, a session which
+ * never ends keeps STATS_OPEN and is counted by the next one.
+ *
+ * Slot: record (STATS_RECORD_SIZE), check (1)
+ */
+
+typedef struct {
+	u32 written;            // bytes programmed
+	u16 erased;             // pages erased
+	u32 elapsed;            // ms from the first change to the manifestation
+	u8 error;               // last DFU status other than OK
+	u8 flags;
+	u8 interrupted;         // sessions never manifested before this one
+	u16 session;            // running number
+} StatsRecord;
+
+#define STATS_RECORD_SIZE 15
+#define STATS_OPEN        0x01
+
+extern StatsRecord stats;
+
+void stats_begin(void);
+void stats_tick(void);
+void stats_end(void);
+u8 stats_read(u8 age, u8 *buffer);
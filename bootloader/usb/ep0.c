@@ -27,6 +27,11 @@
 #include "usb/usb_std_req.h"
 #include "usb/usb.h"
 #include "dfu/dfu.h"
+#ifdef BULK_TRANSFER
+#include "usb/ep1.h"
+#endif
+#include "usb/usb_ram.h"
+#include "bringup.h"
 
 /* Control Transfer States */
 #define WAIT_SETUP          0
@@ -35,17 +40,14 @@
 #define WAIT_DFU_IN         3
 #define WAIT_DFU_OUT        4
 
-#pragma udata usbram5 SetupBuffer
-volatile far StandardRequest SetupBuffer;
-
-#pragma udata usbram5 InBuffer
-volatile far u8 InBuffer[EP0_BUFFER_SIZE];
-
-static u8 ep0_state;
-static u16 num_bytes_to_be_send;
-static u8 *sourceData;
+#pragma udata access ep0_state
+static u8 __at(ACCESS_EP0_STATE) ep0_state;
+#pragma udata access num_bytes_to_be_send
+static u16 __at(ACCESS_EP0_LENGTH) num_bytes_to_be_send;
+#pragma udata access sourceData
+static u8 __at(ACCESS_EP0_SOURCE) *sourceData;
 static u8 coming_cfg;
-u8 ReadBuffer[EP0_BUFFER_SIZE];
+static u8 num_bytes_received;
 
 u8 ep0_usb_std_request(void) {
 	// hack to avoid register allocation bug in sdcc
@@ -69,6 +71,7 @@ u8 ep0_usb_std_request(void) {
 		break;
 	case GET_DESCRIPTOR:
 		debug_usb("GET_DESCRIPTOR\n");
+		bringup_mark(BRINGUP_DESCRIPTOR);
 		switch (SetupBuffer.bDescType) {
 
 		case DEVICE_DESCRIPTOR:
@@ -78,13 +81,13 @@ u8 ep0_usb_std_request(void) {
 			break;
 		case CONFIGURATION_DESCRIPTOR:
 			debug_usb("configuration\n");
-			sourceData = configuration_descriptor[SetupBuffer.bDescIndex];
+			sourceData = (u8 *) configuration_descriptor[SetupBuffer.bDescIndex];
 			num_bytes_to_be_send =
 					((USB_Configuration_Descriptor*) sourceData)->wTotalLength;
 			break;
 		case STRING_DESCRIPTOR:
 			debug_usb("string\n");
-			sourceData = string_descriptor[SetupBuffer.bDescIndex];
+			sourceData = (u8 *) string_descriptor[SetupBuffer.bDescIndex];
 			num_bytes_to_be_send = sourceData[0];
 			break;
 		default:
@@ -96,7 +99,8 @@ u8 ep0_usb_std_request(void) {
 		break;
 	case GET_INTERFACE:
 		debug_usb("GET_INTERFACE\n");
-		// TODO not implemented
+		sourceData = &GET_ACTIVE_ALTERNATE_SETTING();
+		num_bytes_to_be_send = 1;
 		break;
 	case GET_STATUS:
 		debug_usb("GET_STATUS\n");
@@ -128,7 +132,24 @@ u8 ep0_usb_std_request(void) {
 		break;
 	case SET_INTERFACE:
 		debug_usb("SET_INTERFACE\n");
-		// TODO not implemented
+		if (application_data) {
+			// Interfaces of applications have no alternate settings
+			if (SetupBuffer.bLSBAlternateSetting != 0) {
+				unknown_request = TRUE;
+			}
+		} else if (SetupBuffer.bLSBInterface == 0
+				&& SetupBuffer.bLSBAlternateSetting < ALT_SETTINGS) {
+			SET_ACTIVE_ALTERNATE_SETTING(SetupBuffer.bLSBAlternateSetting);
+			init_dfu();
+#ifdef BULK_TRANSFER
+		} else if (SetupBuffer.bLSBInterface == BULK_INTERFACE
+				&& SetupBuffer.bLSBAlternateSetting == 0) {
+			ep1_init();
+#endif
+		} else {
+			debug_usb("invalid alternate setting\n");
+			unknown_request = TRUE;
+		}
 		break;
 //        case SYNCH_FRAME:
 // only for isochronous synchronization
@@ -145,17 +166,25 @@ u8 ep0_dfu_request(void) {
 
 	unknown_request = FALSE;
 
-	if (SetupBuffer.request_type != CLASS
-			|| SetupBuffer.recipient != RECIPIENT_INTERFACE) {
-		return FALSE;
+	if (application_data) {
+		return application_data->ep0_request
+				&& application_data->ep0_request((StandardRequest __data *)&SetupBuffer,
+						&sourceData, &num_bytes_to_be_send);
 	}
 
-	unknown_request = !process_dfu_request((u8 __data *)&SetupBuffer);
+	if (SetupBuffer.request_type == VENDOR) {
+		unknown_request = !process_vendor_request((StandardRequest __data *)&SetupBuffer);
+	} else if (SetupBuffer.request_type == CLASS
+			&& SetupBuffer.recipient == RECIPIENT_INTERFACE
+			&& SetupBuffer.bLSBInterface == 0) {
+		unknown_request = !process_dfu_request((StandardRequest __data *)&SetupBuffer);
+	} else {
+		return FALSE;
+	}
 
 	if (!unknown_request) {
 		if (SetupBuffer.data_transfer_direction == DEVICE_TO_HOST) {
-			num_bytes_to_be_send = read_dfu_data((u8 __data *)&SetupBuffer, (u8 __data *)ReadBuffer, EP0_BUFFER_SIZE);
-			sourceData = (u8 __data *) ReadBuffer;
+			num_bytes_to_be_send = read_dfu_data((StandardRequest __data *)&SetupBuffer, &sourceData);
 		}
 	}
 
@@ -164,7 +193,9 @@ u8 ep0_dfu_request(void) {
 
 void ep0_init(void) {
 	debug_usb("ep0_init\r\n");
-	init_dfu();
+	if (!application_data) {
+		init_dfu();
+	}
 	ep0_state = WAIT_SETUP;
 	EP_OUT_BD(0).Cnt = EP0_BUFFER_SIZE;
 	EP_OUT_BD(0).ADR = (u8 __data *)&SetupBuffer;
@@ -173,9 +204,36 @@ void ep0_init(void) {
 	UEP0 = EPINEN_EN | EPOUTEN_EN | EPHSHK_EN;
 }
 
+/*
+ * Arm endpoint 0 for the next packet of a host to device data stage,
+ * the packets are collected in DataBuffer
+ */
+void ep0_receive(void) {
+	u8 space = DATA_BUFFER_SIZE - num_bytes_received;
+
+	EP_OUT_BD(0).Cnt = space < EP0_BUFFER_SIZE ? space : EP0_BUFFER_SIZE;
+	EP_OUT_BD(0).ADR = (u8 __data *)&DataBuffer[num_bytes_received];
+}
+
 void ep0_out(void) {
 	if (ep0_state == WAIT_DFU_OUT) {
-		process_dfu_data((u8 __data *)InBuffer, SetupBuffer.wLength);
+		num_bytes_received += EP_OUT_BD(0).Cnt;
+		if (num_bytes_received < SetupBuffer.wLength
+				&& num_bytes_received < DATA_BUFFER_SIZE
+				&& EP_OUT_BD(0).Cnt == EP0_BUFFER_SIZE) {
+			ep0_receive();
+			if (EP_OUT_BD(0).Stat.DTS == 0) {
+				EP_OUT_BD(0).Stat.uc = BDS_USIE | BDS_DAT1 | BDS_DTSEN;
+			} else {
+				EP_OUT_BD(0).Stat.uc = BDS_USIE | BDS_DAT0 | BDS_DTSEN;
+			}
+			return;
+		}
+		if (!application_data) {
+			process_dfu_data((u8 __data *)DataBuffer, SetupBuffer.wLength);
+		} else if (application_data->ep0_data) {
+			application_data->ep0_data((u8 __data *)DataBuffer, num_bytes_received);
+		}
 	}
 	ep0_state = WAIT_SETUP;
 	EP_OUT_BD(0).Cnt = EP0_BUFFER_SIZE;
@@ -193,6 +251,7 @@ void ep0_in(void) {
 		UADDR = SetupBuffer.bAddress;
 		if (UADDR != 0) {
 			SET_DEVICE_STATE(ADDRESS_STATE);
+			bringup_mark(BRINGUP_ADDRESS);
 		} else {
 			SET_DEVICE_STATE(DEFAULT_STATE);
 		}
@@ -226,48 +285,10 @@ void ep0_in(void) {
 
 	if (GET_DEVICE_STATE() == CONFIGURATION_PENDING_STATE) {
 
-		// First, disable all endpoints.
-		// UEP0 is never disabled
-		UEP1 = 0;
-		UEP2 = 0;
-		UEP3 = 0;
-		UEP4 = 0;
-		UEP5 = 0;
-		UEP6 = 0;
-		UEP7 = 0;
-		UEP8 = 0;
-		UEP9 = 0;
-		UEP10 = 0;
-		UEP11 = 0;
-		UEP12 = 0;
-		UEP13 = 0;
-		UEP14 = 0;
-		UEP15 = 0;
-
-		// switch the functions vectors
-		/*
-		 if(coming_cfg <= FLASH_CONFIGURATION)
-		 {
-		 // switch back to the bootloader vectors
-		 ep_init  = boot_ep_init;
-		 ep_in    = boot_ep_in;
-		 ep_out   = boot_ep_out;
-		 ep_setup = boot_ep_setup;
-		 }
-		 else
-		 {
-		 // switch to the application vectors
-		 ep_init  = application_data.ep_init;
-		 ep_in    = application_data.ep_in;
-		 ep_out   = application_data.ep_out;
-		 ep_setup = application_data.ep_setup;
-		 }
-		 */
-		ep_init = boot_ep_init;
-		ep_in = boot_ep_in;
-		ep_out = boot_ep_out;
-		ep_setup = boot_ep_setup;
+		// First, disable all endpoints
+		disable_endpoints();
 
+		// The endpoint tables stay the ones of main() or usb_register()
 		SET_ACTIVE_CONFIGURATION(coming_cfg);
 
 		if (coming_cfg == 0) {
@@ -283,6 +304,7 @@ void ep0_in(void) {
 			}
 
 			SET_DEVICE_STATE(CONFIGURED_STATE);
+			bringup_mark(BRINGUP_CONFIGURED);
 		}
 	}
 }
@@ -314,8 +336,8 @@ void ep0_setup(void) {
 		{
 			ep0_state = WAIT_OUT;
 
-			EP_OUT_BD(0).Cnt = EP0_BUFFER_SIZE;
-			EP_OUT_BD(0).ADR = (u8 __data *)InBuffer;
+			num_bytes_received = 0;
+			ep0_receive();
 			EP_OUT_BD(0).Stat.uc = BDS_USIE | BDS_DAT1 | BDS_DTSEN;
 
 			EP_IN_BD(0).Cnt = 0;
@@ -344,8 +366,8 @@ void ep0_setup(void) {
 		{
 			ep0_state = WAIT_DFU_OUT;
 
-			EP_OUT_BD(0).Cnt = EP0_BUFFER_SIZE;
-			EP_OUT_BD(0).ADR = (u8 __data *)InBuffer;
+			num_bytes_received = 0;
+			ep0_receive();
 			EP_OUT_BD(0).Stat.uc = BDS_USIE | BDS_DAT1 | BDS_DTSEN;
 
 			EP_IN_BD(0).Cnt = 0;
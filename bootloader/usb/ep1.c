@@ -0,0 +1,177 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *         Based on Pierre Gaufillet's <pierre.gaufillet@magic.fr> PUF
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <pic18fregs.h>
+
+#include "typedef.h"
+#include "debug.h"
+#include "usb/usb_descriptors.h"
+#include "usb/usb_std_req.h"
+#include "usb/usb.h"
+#include "usb/ep1.h"
+#include "usb/usb_ram.h"
+#include "dfu/dfu.h"
+#include "flash.h"
+
+#if BULK_PACKET_SIZE % FLASH_WRITE_SIZE
+#error "A bulk data packet has to hold whole flash write blocks"
+#endif
+
+static u8 bulk_status;
+static u8 bulk_seq;
+static flash_addr bulk_address;
+static u8 bulk_frames;
+static u8 bulk_ack_pending;
+static u8 bulk_packets;
+
+void ep1_send_ack(void) {
+	if (EP_IN_BD(BULK_EP).Stat.UOWN) {
+		// Previous acknowledge not yet read, send the newest afterwards
+		bulk_ack_pending = TRUE;
+		return;
+	}
+	bulk_ack_pending = FALSE;
+	BulkInBuffer[0] = bulk_status;
+	BulkInBuffer[1] = bulk_seq;
+	BulkInBuffer[2] = LOWB(bulk_address);
+	BulkInBuffer[3] = HIGHB(bulk_address) & 0xFF;
+	BulkInBuffer[4] = ((u32) bulk_address >> 16) & 0xFF;
+	EP_IN_BD(BULK_EP).Cnt = BULK_ACK_SIZE;
+	if (EP_IN_BD(BULK_EP).Stat.DTS == 0) {
+		EP_IN_BD(BULK_EP).Stat.uc = BDS_USIE | BDS_DAT1 | BDS_DTSEN;
+	} else {
+		EP_IN_BD(BULK_EP).Stat.uc = BDS_USIE | BDS_DAT0 | BDS_DTSEN;
+	}
+}
+
+u8 ep1_frame(u8 op, u8 length) {
+	if (op == BULK_WRITE) {
+		// In 32 bit, APP_END + 1 overflows a 16 bit int
+		if (length > ((u32) APP_END + 1 - ENTRY) / BULK_PACKET_SIZE
+				|| bulk_address & (FLASH_WRITE_SIZE - 1) || bulk_address < ENTRY
+				|| (u32) bulk_address + (u16) length * BULK_PACKET_SIZE > (u32) APP_END + 1) {
+			return errADDRESS;
+		}
+	} else if (op == BULK_ERASE) {
+		while (length--) {
+			if (bulk_address < ENTRY || bulk_address > APP_END) {
+				return errADDRESS;
+			}
+			image_erase(bulk_address);
+			bulk_address += ERASE_PAGE_SIZE;
+		}
+	} else if (op != BULK_SYNC) {
+		return errSTALLEDPKT;
+	}
+	return OK;
+}
+
+/*
+ * One data packet of a write frame
+ */
+u8 ep1_data(void) {
+	u8 status;
+
+	if (EP_OUT_BD(BULK_EP).Cnt != BULK_PACKET_SIZE) {
+		return errWRITE;
+	}
+	status = image_program(bulk_address, (u8 __data *)BulkOutBuffer, BULK_PACKET_SIZE);
+	if (status != OK) {
+		bulk_address = error_address;
+		return status;
+	}
+	bulk_address += BULK_PACKET_SIZE;
+	return OK;
+}
+
+/*
+ * A frame is processed, acknowledge at the end of the window
+ */
+void ep1_done(u8 op) {
+	bulk_frames++;
+	if (bulk_status != OK || op == BULK_SYNC || bulk_frames == BULK_WINDOW) {
+		bulk_frames = 0;
+		ep1_send_ack();
+	}
+}
+
+void ep1_init(void) {
+	debug_usb("ep1_init\n");
+	bulk_status = OK;
+	bulk_seq = 0;
+	bulk_address = 0;
+	bulk_frames = 0;
+	bulk_ack_pending = FALSE;
+	bulk_packets = 0;
+	EP_OUT_BD(BULK_EP).Cnt = BULK_PACKET_SIZE;
+	EP_OUT_BD(BULK_EP).ADR = (u8 __data *)BulkOutBuffer;
+	EP_OUT_BD(BULK_EP).Stat.uc = BDS_USIE | BDS_DAT0 | BDS_DTSEN;
+	EP_IN_BD(BULK_EP).ADR = (u8 __data *)BulkInBuffer;
+	EP_IN_BD(BULK_EP).Stat.uc = BDS_UCPU | BDS_DAT1;
+	UEP1 = EPHSHK_EN | EPCONDIS_EN | EPOUTEN_EN | EPINEN_EN;
+}
+
+void ep1_out(void) {
+	u8 op = BulkOutBuffer[0];
+
+	if (bulk_packets) {
+		// Data of a write frame, skipped after an error
+		bulk_packets--;
+		if (bulk_status == OK) {
+			bulk_status = ep1_data();
+			if (bulk_status != OK || bulk_packets == 0) {
+				ep1_done(BULK_WRITE);
+			}
+		}
+	} else if (op == BULK_CLEAR) {
+		bulk_status = OK;
+	} else {
+		if (op == BULK_WRITE) {
+			bulk_packets = BulkOutBuffer[5];
+		}
+		if (bulk_status == OK) {
+			bulk_seq = BulkOutBuffer[1];
+#ifdef FLASH_ADDR_16
+			// Addresses above 64 KB fail the range checks
+			bulk_address = BulkOutBuffer[4] ? 0xFFFF : BulkOutBuffer[2] | (u16) BulkOutBuffer[3] << 8;
+#else
+			bulk_address = (u32) BulkOutBuffer[4] << 16 | (u16) BulkOutBuffer[3] << 8 | BulkOutBuffer[2];
+#endif
+			bulk_status = ep1_frame(op, BulkOutBuffer[5]);
+			if (bulk_status != OK || bulk_packets == 0) {
+				ep1_done(op);
+			}
+		}
+	}
+
+	// Ready for the next frame
+	EP_OUT_BD(BULK_EP).Cnt = BULK_PACKET_SIZE;
+	if (EP_OUT_BD(BULK_EP).Stat.DTS == 0) {
+		EP_OUT_BD(BULK_EP).Stat.uc = BDS_USIE | BDS_DAT1 | BDS_DTSEN;
+	} else {
+		EP_OUT_BD(BULK_EP).Stat.uc = BDS_USIE | BDS_DAT0 | BDS_DTSEN;
+	}
+}
+
+void ep1_in(void) {
+	if (bulk_ack_pending) {
+		ep1_send_ack();
+	}
+}
@@ -0,0 +1,52 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *         Based on Pierre Gaufillet's <pierre.gaufillet@magic.fr> PUF
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Bulk transfer interface
+ *
+ * The host sends address tagged frames on EP1 OUT, the device answers
+ * with an acknowledge on EP1 IN after every BULK_WINDOW frames, after
+ * BULK_SYNC and after an error. The status codes are the DFU status
+ * values, after an error all frames except BULK_CLEAR are ignored.
+ *
+ * Frame:       op, seq, address (3), length
+ * Acknowledge: status, seq of the last processed frame, address (3)
+ *
+ * A write frame is followed by length data packets of BULK_PACKET_SIZE
+ * bytes, each programmed as whole FLASH_WRITE_SIZE blocks. The address
+ * has to be aligned to FLASH_WRITE_SIZE and the data has to fit into
+ * the application, otherwise the frame fails with errADDRESS and its
+ * data packets are skipped.
+ */
+#define BULK_INTERFACE      1
+#define BULK_EP             1
+#define BULK_PACKET_SIZE    64
+#define BULK_HEADER_SIZE    6
+#define BULK_ACK_SIZE       5
+#define BULK_WINDOW         8
+
+#define BULK_WRITE          0x01 // write length data packets at address
+#define BULK_ERASE          0x02 // erase length pages from address on
+#define BULK_SYNC           0x03 // acknowledge now
+#define BULK_CLEAR          0x04 // clear error status
+
+void ep1_init(void);
+void ep1_in(void);
+void ep1_out(void);
@@ -27,10 +27,20 @@
 #include "debug.h"
 #include "typedef.h"
 #include "usb/usb_descriptors.h"
+#include "usb/usb_std_req.h"
 #include "usb/usb.h"
+#ifdef BULK_TRANSFER
+#include "usb/ep1.h"
+#endif
+#include "usb/usb_ram.h"
+#include "bringup.h"
 
 /* Buffer descriptors Table */
 volatile BufferDescriptorTable __at (0x400) ep_bdt[32];
+
+#pragma udata usbram5 usb_ram
+volatile far USB_RAM_Arena usb_ram;
+
 const USB_Device_Descriptor *device_descriptor;
 const void **configuration_descriptor;
 const u8* const *string_descriptor;
@@ -40,12 +50,29 @@ void (***ep_in)(void);
 void (***ep_out)(void);
 void (***ep_setup)(void);
 
+const ApplicationData *application_data;
+
 #pragma udata access usb_device_state
-u8 __at(0x005f) usb_device_state;
+u8 __at(ACCESS_USB_DEVICE_STATE) usb_device_state;
 #pragma udata access usb_active_cfg
-u8 __at(0x005e) usb_active_cfg;
+u8 __at(ACCESS_USB_ACTIVE_CFG) usb_active_cfg;
 #pragma udata access usb_active_alt_setting
-u8 __at(0x005d) usb_active_alt_setting;
+u8 __at(ACCESS_USB_ALT_SETTING) usb_active_alt_setting;
+
+/*
+ * Replace the device of the bootloader by the one of an application,
+ * class and vendor requests on ep0 are passed to the application
+ */
+void usb_register(const ApplicationData *app) {
+	application_data = app;
+	device_descriptor = app->device_descriptor;
+	configuration_descriptor = app->configuration_descriptor;
+	string_descriptor = app->string_descriptor;
+	ep_init = app->ep_init;
+	ep_in = app->ep_in;
+	ep_out = app->ep_out;
+	ep_setup = app->ep_setup;
+}
 
 void init_usb(void) {
 	debug_usb("USB Init\r\n");
@@ -59,29 +86,27 @@ void init_usb(void) {
 	SET_ACTIVE_ALTERNATE_SETTING(DEFAULT_CONFIGURATION);
 }
 
+/*
+ * Attach to the bus, calls after the first one return at once
+ *
+ * The device waits in ATTACHED_STATE until dispatch_usb_event sees the
+ * bus leave SE0 or a latched bus reset, a bus powered board passes that
+ * check in its first pass. The bus reset of the host is latched in
+ * URSTIF, so nothing is lost while the rest of the bring-up runs.
+ */
 void enable_usb(void) {
-
-	// TBD: Check for voltage coming from the USB cable and use that
-	// as an indication we are attached.
-	if (UCONbits.USBEN == 0) {
-		debug_usb("Device attached\r\n");
-		UCON = 0;
-		UIE = 0;
-		UCONbits.USBEN = 1;
-		SET_DEVICE_STATE(ATTACHED_STATE);
-	}
-
-	// If we are attached and no single-ended zero is detected, then
-	// we can move to the Powered state.
-	if ((GET_DEVICE_STATE() == ATTACHED_STATE) && !UCONbits.SE0) {
-		debug_usb("Device powered\r\n");
-		UIR = 0;
-		UIE = 0;
-		UIEbits.URSTIE = 1;
-		UIEbits.IDLEIE = 1;
-		SET_DEVICE_STATE(POWERED_STATE);
+	if (UCONbits.USBEN) {
+		return;
 	}
-
+	debug_usb("Device attached\r\n");
+	UCON = 0;
+	UIR = 0;
+	UIE = 0;
+	UIEbits.URSTIE = 1;
+	UIEbits.IDLEIE = 1;
+	UCONbits.USBEN = 1;
+	SET_DEVICE_STATE(ATTACHED_STATE);
+	bringup_mark(BRINGUP_ATTACHED);
 }
 
 void unsuspend(void) {
@@ -104,9 +129,28 @@ void close_usb(void) {
 	UCONbits.USBEN = 0;
 }
 
-void bus_reset() {
-	u8 i;
+/*
+ * UEP0 is never disabled
+ */
+void disable_endpoints(void) {
+	UEP1 = 0;
+	UEP2 = 0;
+	UEP3 = 0;
+	UEP4 = 0;
+	UEP5 = 0;
+	UEP6 = 0;
+	UEP7 = 0;
+	UEP8 = 0;
+	UEP9 = 0;
+	UEP10 = 0;
+	UEP11 = 0;
+	UEP12 = 0;
+	UEP13 = 0;
+	UEP14 = 0;
+	UEP15 = 0;
+}
 
+void bus_reset() {
 	debug_usb("Bus reset\r\n");
 	UEIR = 0x00;
 	UIR = 0x00;
@@ -124,22 +168,10 @@ void bus_reset() {
 	// Enable packet processing
 	UCONbits.PKTDIS = 0;
 
-	UEP0 = 0;
-	UEP1 = 0;
-	UEP2 = 0;
-	UEP3 = 0;
-	UEP4 = 0;
-	UEP5 = 0;
-	UEP6 = 0;
-	UEP7 = 0;
-	UEP8 = 0;
-	UEP9 = 0;
-	UEP10 = 0;
-	UEP11 = 0;
-	UEP12 = 0;
-	UEP13 = 0;
-	UEP14 = 0;
-	UEP15 = 0;
+	// Endpoints 1-15 are only enabled by a configuration
+	if (GET_ACTIVE_CONFIGURATION() != 0) {
+		disable_endpoints();
+	}
 
 	// remoteWakeup = 0;                     // Remote wakeup is off by default
 	// selfPowered = 0;                      // Self powered is off by default
@@ -147,10 +179,9 @@ void bus_reset() {
 	SET_ACTIVE_CONFIGURATION(0);
 	SET_ACTIVE_ALTERNATE_SETTING(0);
 
-	debug_usb("Start ep_init\r\n");
-	for (i = 0; i < 16; i++) {
-		ep_init[0][i]();
-	}
+	// Only endpoint 0 exists until the device is configured
+	ep_init[0][0]();
+	bringup_mark(BRINGUP_RESET);
 
 }
 
@@ -219,6 +250,14 @@ void dispatch_usb_event(void) {
 	if (GET_DEVICE_STATE() == DETACHED_STATE)
 		return;
 
+	// Powered once the bus leaves SE0 or the host has reset it
+	if (GET_DEVICE_STATE() == ATTACHED_STATE) {
+		if (UCONbits.SE0 && !UIRbits.URSTIF)
+			return;
+		debug_usb("Device powered\r\n");
+		SET_DEVICE_STATE(POWERED_STATE);
+	}
+
 	// If the USB became active then wake up from suspend
 	if (UIRbits.ACTVIF && UIEbits.ACTVIE)
 		unsuspend();
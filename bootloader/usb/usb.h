@@ -141,9 +141,9 @@ typedef union {
 /* Buffer descriptors Table */
 extern volatile BufferDescriptorTable __at (0x400) ep_bdt[32];
 
-extern u8 __at(0x005f) usb_device_state;
-extern u8 __at(0x005e) usb_active_cfg;
-extern u8 __at(0x005d) usb_active_alt_setting;
+extern u8 __at(ACCESS_USB_DEVICE_STATE) usb_device_state;
+extern u8 __at(ACCESS_USB_ACTIVE_CFG) usb_active_cfg;
+extern u8 __at(ACCESS_USB_ALT_SETTING) usb_active_alt_setting;
 
 extern const USB_Device_Descriptor *device_descriptor;
 extern const void **configuration_descriptor;
@@ -154,9 +154,31 @@ extern void (***ep_in)(void);
 extern void (***ep_out)(void);
 extern void (***ep_setup)(void);
 
+/*
+ * USB device of an application using the bootloader services
+ */
+typedef struct {
+	const USB_Device_Descriptor *device_descriptor;
+	const void **configuration_descriptor;
+	const u8* const *string_descriptor;
+	void (***ep_init)(void);
+	void (***ep_in)(void);
+	void (***ep_out)(void);
+	void (***ep_setup)(void);
+	// Class and vendor requests on ep0, TRUE if the request is accepted,
+	// device to host requests set the answer in data and length
+	u8 (*ep0_request)(StandardRequest *request, u8 **data, u16 *length);
+	// Data stage of an accepted host to device request
+	void (*ep0_data)(u8 *buffer, u16 length);
+} ApplicationData;
+
+extern const ApplicationData *application_data;
+
+void usb_register(const ApplicationData *app);
 void init_usb(void);
 void enable_usb(void);
 void close_usb(void);
+void disable_endpoints(void);
 void dispatch_usb_event(void);
 void fill_in_buffer(u8 EPnum, u8 **source, u16 buffer_size, u16 *nb_byte);
 
@@ -21,6 +21,9 @@
 #include "typedef.h"
 #include "usb/usb_descriptors.h"
 #include "usb/ep0.h"
+#ifdef BULK_TRANSFER
+#include "usb/ep1.h"
+#endif
 
 const USB_Device_Descriptor boot_device_descriptor = {
 		sizeof(USB_Device_Descriptor),    // Size of this descriptor in bytes
@@ -45,7 +48,11 @@ const USB_Default_Composite_Descriptor boot_default_cfg = {
 		{ sizeof(USB_Configuration_Descriptor), // Size of this descriptor in bytes
 				CONFIGURATION_DESCRIPTOR,       // CONFIGURATION descriptor type
 				sizeof(boot_default_cfg), // Total length of data for this configuration
+#ifdef BULK_TRANSFER
+				2,                 // Number of interfaces in this configuration
+#else
 				1,                 // Number of interfaces in this configuration
+#endif
 				1,                      // Index value of this configuration
 				4,                      // Configuration string index
 				DEFAULT,                // Attributes
@@ -62,12 +69,50 @@ const USB_Default_Composite_Descriptor boot_default_cfg = {
 				0x02,                   // Protocol code
 				5 },                     // Interface string index
 
+		// Boot Interface Descriptor, data EEPROM
+		{ sizeof(USB_Interface_Descriptor),  // Size of this descriptor in bytes
+				INTERFACE_DESCRIPTOR,               // Interface descriptor type
+				0,                      // Interface Number
+				1,                      // Alternate Setting Number
+				0,                      // Number of endpoints in this interface
+				0xfe,                   // Class code
+				0x01,                   // Subclass code
+				0x02,                   // Protocol code
+				6 },                     // Interface string index
+
 		{ sizeof(DFU_Functional_Descriptor), // Size of this descriptor in bytes
 				DFU_INTERFACE_DESCRIPTOR,       // DFU Interface descriptor type
 				0x0b,  // bmAttributes: bitCanDnload | bitCanUpload | willDetach
 				0x00ff,                             // Detach timeout in ms: 255
-				0x0020,                           // Transfersize in bytes: 32
+				DATA_BUFFER_SIZE,                 // Transfersize in bytes
 				0x011a },                              // DFU Version. 1.1a
+
+#ifdef BULK_TRANSFER
+		// Bulk transfer Interface Descriptor
+		{ sizeof(USB_Interface_Descriptor),  // Size of this descriptor in bytes
+				INTERFACE_DESCRIPTOR,               // Interface descriptor type
+				BULK_INTERFACE,         // Interface Number
+				0,                      // Alternate Setting Number
+				2,                      // Number of endpoints in this interface
+				0xff,                   // Class code: vendor specific
+				0x00,                   // Subclass code
+				0x00,                   // Protocol code
+				7 },                     // Interface string index
+
+		{ { sizeof(USB_Endpoint_Descriptor), // Size of this descriptor in bytes
+				ENDPOINT_DESCRIPTOR,            // Endpoint descriptor type
+				EP(BULK_EP) | OUT_EP,           // Endpoint address
+				BULK,                           // Attributes
+				BULK_PACKET_SIZE,               // Max packet size
+				0 },                            // Interval
+
+		{ sizeof(USB_Endpoint_Descriptor),   // Size of this descriptor in bytes
+				ENDPOINT_DESCRIPTOR,            // Endpoint descriptor type
+				EP(BULK_EP) | IN_EP,            // Endpoint address
+				BULK,                           // Attributes
+				BULK_PACKET_SIZE,               // Max packet size
+				0 } },                          // Interval
+#endif
 		};
 
 const u8 * const boot_configuration_descriptor[] = {
@@ -142,22 +187,75 @@ const u8 str5[] = {sizeof(str5),  STRING_DESCRIPTOR,
                                               '/',0x00,
                                               '0',0x00,
                                               'x',0x00,
+                                              ENTRY_STRING,
+                                              '/',0x00,
+                                              FLASH_LAYOUT_PAGES,
+                                              '*',0x00,
+                                              '0',0x00,
+                                              '6',0x00,
                                               '4',0x00,
+                                              'B',0x00,
+                                              'g',0x00};
+
+const u8 str6[] = {sizeof(str6),  STRING_DESCRIPTOR,
+                                              '@',0x00,
+                                              'D',0x00,
+                                              'a',0x00,
+                                              't',0x00,
+                                              'a',0x00,
+                                              ' ',0x00,
+                                              'E',0x00,
+                                              'E',0x00,
+                                              'P',0x00,
+                                              'R',0x00,
+                                              'O',0x00,
+                                              'M',0x00,
+                                              ' ',0x00,
+                                              '/',0x00,
+                                              '0',0x00,
+                                              'x',0x00,
+                                              'F',0x00,
+                                              '0',0x00,
+                                              '0',0x00,
                                               '0',0x00,
                                               '0',0x00,
                                               '0',0x00,
                                               '/',0x00,
+                                              '0',0x00,
+                                              '4',0x00,
+                                              '*',0x00,
+                                              '0',0x00,
                                               '3',0x00,
                                               '2',0x00,
+                                              'B',0x00,
+                                              'e',0x00,
+                                              ',',0x00,
                                               '0',0x00,
+                                              '4',0x00,
                                               '*',0x00,
                                               '0',0x00,
-                                              '6',0x00,
-                                              '4',0x00,
+                                              '3',0x00,
+                                              '2',0x00,
                                               'B',0x00,
-                                              'g',0x00};
+                                              'a',0x00};
+
+#ifdef BULK_TRANSFER
+const u8 str7[] = {sizeof(str7),  STRING_DESCRIPTOR,
+                                              'B',0x00,
+                                              'u',0x00,
+                                              'l',0x00,
+                                              'k',0x00,
+                                              ' ',0x00,
+                                              'F',0x00,
+                                              'l',0x00,
+                                              'a',0x00,
+                                              's',0x00,
+                                              'h',0x00};
 
-const u8 * const boot_string_descriptor[] = {str0, str1, str2, str3, str4, str5};
+const u8 * const boot_string_descriptor[] = {str0, str1, str2, str3, str4, str5, str6, str7};
+#else
+const u8 * const boot_string_descriptor[] = {str0, str1, str2, str3, str4, str5, str6};
+#endif
 
 /******************************************************************************
  * USB Endpoints callbacks
@@ -188,7 +286,11 @@ static void (* const boot_ep_init_cfg0 [])(void) = {
                                         null_function};
 static void (* const boot_ep_init_cfg1 [])(void) = {
                                         ep0_init,      // 0
+#ifdef BULK_TRANSFER
+                                        ep1_init,      // 1
+#else
                                         null_function, // 1
+#endif
                                         null_function, // 2
                                         null_function, // 3
                                         null_function, // 4
@@ -205,13 +307,13 @@ static void (* const boot_ep_init_cfg1 [])(void) = {
                                         null_function};// 15
 
 /*
- *  boot_ep_init_cfg0 is duplicated so it is used on cfg 0 (device not configured)
- * and 1 (device configured)
+ *  The tables are indexed with the active configuration: cfg 0 (device not
+ * configured) and 1 (device configured), boot_ep_*_cfg1 is duplicated for 2
  */
 
 void (** const boot_ep_init[])(void) = {
                                          boot_ep_init_cfg0,
-                                         boot_ep_init_cfg0,
+                                         boot_ep_init_cfg1,
                                          boot_ep_init_cfg1
                                        };
 
@@ -235,7 +337,11 @@ static void (* const boot_ep_in_cfg0 [])(void) = {
 
 static void (* const boot_ep_in_cfg1 [])(void) = {
                                         ep0_in,       // 0
+#ifdef BULK_TRANSFER
+                                        ep1_in,      // 1
+#else
                                         null_function, // 1
+#endif
                                         null_function, // 2
                                         null_function, // 3
                                         null_function, // 4
@@ -253,7 +359,7 @@ static void (* const boot_ep_in_cfg1 [])(void) = {
 
 void (** const boot_ep_in[])(void) =   {
                                         boot_ep_in_cfg0,
-                                        boot_ep_in_cfg0,
+                                        boot_ep_in_cfg1,
                                         boot_ep_in_cfg1
                                        };
 
@@ -277,7 +383,11 @@ static void (* const boot_ep_out_cfg0 [])(void) = {
 
 static void (* const boot_ep_out_cfg1 [])(void) = {
                                         ep0_out,      // 0
+#ifdef BULK_TRANSFER
+                                        ep1_out,      // 1
+#else
                                         null_function, // 1
+#endif
                                         null_function, // 2
                                         null_function, // 3
                                         null_function, // 4
@@ -295,7 +405,7 @@ static void (* const boot_ep_out_cfg1 [])(void) = {
 
 void (** const boot_ep_out[])(void) =  {
                                         boot_ep_out_cfg0,
-                                        boot_ep_out_cfg0,
+                                        boot_ep_out_cfg1,
                                         boot_ep_out_cfg1
                                        };
 
@@ -18,6 +18,8 @@
  * License along with this library.
  */
 
+#include "config.h"
+
 /* Descriptor Types */
 #define DEVICE_DESCRIPTOR        0x01
 #define CONFIGURATION_DESCRIPTOR 0x02
@@ -128,7 +130,12 @@ typedef struct {
 typedef struct {
 	USB_Configuration_Descriptor cd;
 	USB_Interface_Descriptor i0;
+	USB_Interface_Descriptor i0a1;
 	DFU_Functional_Descriptor fd;
+#ifdef BULK_TRANSFER
+	USB_Interface_Descriptor i1;
+	USB_Endpoint_Descriptor ep1_dsc[2];
+#endif
 } USB_Default_Composite_Descriptor;
 
 typedef struct {
@@ -0,0 +1,55 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *         Based on Pierre Gaufillet's <pierre.gaufillet@magic.fr> PUF
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * USB RAM arena
+ *
+ * Every buffer the SIE reads or writes is a region of one block in
+ * bank 5. A region is handed from one layer to the next as the
+ * transfer goes on instead of copying the data:
+ *
+ * setup     SETUP packet, valid for the whole control transfer
+ * ep0_in    IN packets of endpoint 0, answers which fit one packet are
+ *           built in place (vendor requests)
+ * data      data stage of host to device requests (DATA_BUFFER_SIZE,
+ *           several packets), kept by DFU as the block to write until
+ *           the next DFU_DNLOAD. Between downloads it holds the upload
+ *           block which is sent from here in EP0_BUFFER_SIZE packets.
+ * bulk_*    frames and acknowledges of the bulk interface
+ *
+ * Include usb/ep1.h before this file when BULK_TRANSFER is set.
+ */
+typedef struct {
+	StandardRequest setup;
+	u8 ep0_in[EP0_BUFFER_SIZE];
+	u8 data[DATA_BUFFER_SIZE];
+#ifdef BULK_TRANSFER
+	u8 bulk_out[BULK_PACKET_SIZE];
+	u8 bulk_in[BULK_ACK_SIZE];
+#endif
+} USB_RAM_Arena;
+
+extern volatile far USB_RAM_Arena usb_ram;
+
+#define SetupBuffer     (usb_ram.setup)
+#define InBuffer        (usb_ram.ep0_in)
+#define DataBuffer      (usb_ram.data)
+#define BulkOutBuffer   (usb_ram.bulk_out)
+#define BulkInBuffer    (usb_ram.bulk_in)
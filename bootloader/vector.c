@@ -22,8 +22,11 @@
 /*
  * Interrupt Vector Remapping
  * Only high vector should be needed
+ * With BOOT_TOP the application owns the vectors at 0x0008/0x0018 and
+ * the bootloader only the goto at 0x0000
  */
 
+#ifndef BOOT_TOP
 void interrupt_at_high_vector(void) __naked __interrupt 1 {
     __asm
     	goto ENTRY + 0x0008
@@ -35,3 +38,15 @@ void interrupt_at_low_vector(void) __naked __interrupt 2 {
     	goto ENTRY + 0x0018
     __endasm;
 }
+#else
+/*
+ * Reset of a freshly programmed device, the bootloader writes the same
+ * goto (boot_vector) whenever it erases or programs page 0
+ */
+#pragma code boot_reset 0x0000
+void boot_reset(void) __naked {
+    __asm
+    	goto BOOT_START
+    __endasm;
+}
+#endif
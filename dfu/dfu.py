@@ -4,7 +4,8 @@
 # Distributed under Gnu LGPL 3.0
 # see http://www.gnu.org/licenses/lgpl-3.0.txt
 
-import sys,struct,zlib,os
+from __future__ import print_function
+import sys,struct,zlib,os,binascii
 from optparse import OptionParser
 
 DEFAULT_DEVICE="0x0483:0xdf11"
@@ -15,65 +16,265 @@ def consume(fmt,data,names):
   n = struct.calcsize(fmt)
   return named(struct.unpack(fmt,data[:n]),names),data[n:]
 def cstring(string):
-  return string.split('\0',1)[0]
+  return string.split(b'\0',1)[0].decode('latin-1')
 def compute_crc(data):
   return 0xFFFFFFFF & -zlib.crc32(data) -1
 
 def parse(file,dump_images=False):
-  print 'File: "%s"' % file
+  print('File: "%s"' % file)
   data = open(file,'rb').read()
   crc = compute_crc(data[:-4])
   prefix, data = consume('<5sBIB',data,'signature version size targets')
-  print '%(signature)s v%(version)d, image size: %(size)d, targets: %(targets)d' % prefix
+  prefix['signature'] = cstring(prefix['signature'])
+  print('%(signature)s v%(version)d, image size: %(size)d, targets: %(targets)d' % prefix)
   for t in range(prefix['targets']):
     tprefix, data  = consume('<6sBI255s2I',data,'signature altsetting named name size elements')
     tprefix['num'] = t
+    tprefix['signature'] = cstring(tprefix['signature'])
     if tprefix['named']:
       tprefix['name'] = cstring(tprefix['name'])
     else:
       tprefix['name'] = ''
-    print '%(signature)s %(num)d, alt setting: %(altsetting)s, name: "%(name)s", size: %(size)d, elements: %(elements)d' % tprefix
+    print('%(signature)s %(num)d, alt setting: %(altsetting)s, name: "%(name)s", size: %(size)d, elements: %(elements)d' % tprefix)
     tsize = tprefix['size']
     target, data = data[:tsize], data[tsize:]
     for e in range(tprefix['elements']):
       eprefix, target = consume('<2I',target,'address size')
       eprefix['num'] = e
-      print '  %(num)d, address: 0x%(address)08x, size: %(size)d' % eprefix
+      print('  %(num)d, address: 0x%(address)08x, size: %(size)d' % eprefix)
       esize = eprefix['size']
       image, target = target[:esize], target[esize:]
       if dump_images:
         out = '%s.target%d.image%d.bin' % (file,t,e)
         open(out,'wb').write(image)
-        print '    DUMPED IMAGE TO "%s"' % out
+        print('    DUMPED IMAGE TO "%s"' % out)
     if len(target):
-      print "target %d: PARSE ERROR" % t
+      print("target %d: PARSE ERROR" % t)
   suffix = named(struct.unpack('<4H3sBI',data[:16]),'device product vendor dfu ufd len crc')
-  print 'usb: %(vendor)04x:%(product)04x, device: 0x%(device)04x, dfu: 0x%(dfu)04x, %(ufd)s, %(len)d, 0x%(crc)08x' % suffix
+  suffix['ufd'] = cstring(suffix['ufd'])
+  print('usb: %(vendor)04x:%(product)04x, device: 0x%(device)04x, dfu: 0x%(dfu)04x, %(ufd)s, %(len)d, 0x%(crc)08x' % suffix)
   if crc != suffix['crc']:
-    print "CRC ERROR: computed crc32 is 0x%08x" % crc
+    print("CRC ERROR: computed crc32 is 0x%08x" % crc)
   data = data[16:]
   if data:
-    print "PARSE ERROR"
+    print("PARSE ERROR")
 
-def build(file,targets,device=DEFAULT_DEVICE):
-  data = ''
+# Compressed stream, decoded by the bootloader into its page buffer
+LZ_RUN        = 0x80
+LZ_MATCH      = 0xC0
+LZ_MIN        = 3
+LZ_MAX        = 0x3F + LZ_MIN
+LZ_WINDOW     = 256
+LZ_MAX_LITERAL= 128
+
+def compress(data):
+  data = bytearray(data)
+  out = bytearray()
+  literal = bytearray()
+  chains = {}
+  i = 0
+  while i < len(data):
+    run = 1
+    while i+run < len(data) and run < LZ_MAX and data[i+run] == data[i]:
+      run += 1
+    best, distance = 0, 0
+    for j in reversed(chains.get(bytes(data[i:i+LZ_MIN]),[])):
+      if i-j > LZ_WINDOW:
+        break
+      n = 0
+      while i+n < len(data) and n < LZ_MAX and data[j+n] == data[i+n]:
+        n += 1
+      if n > best:
+        best, distance = n, i-j
+    if run >= LZ_MIN and run >= best:
+      op, length = bytearray([LZ_RUN | (run-LZ_MIN), data[i]]), run
+    elif best >= LZ_MIN:
+      op, length = bytearray([LZ_MATCH | (best-LZ_MIN), distance-1]), best
+    else:
+      op, length = None, 1
+      literal.append(data[i])
+    if op or len(literal) == LZ_MAX_LITERAL:
+      if literal:
+        out.append(len(literal)-1)
+        out += literal
+        literal = bytearray()
+      if op:
+        out += op
+    for k in range(i,i+length):
+      chains.setdefault(bytes(data[k:k+LZ_MIN]),[]).append(k)
+    i += length
+  if literal:
+    out.append(len(literal)-1)
+    out += literal
+  return bytes(out)
+
+def decompress(stream):
+  stream = bytearray(stream)
+  out = bytearray()
+  i = 0
+  while i < len(stream):
+    op = stream[i]
+    if op < LZ_RUN:
+      out += stream[i+1:i+op+2]
+      i += op+2
+    elif op < LZ_MATCH:
+      out += bytearray([stream[i+1]]) * ((op & 0x3F)+LZ_MIN)
+      i += 2
+    else:
+      start = len(out)-stream[i+1]-1
+      for k in range((op & 0x3F)+LZ_MIN):
+        out.append(out[start+k])
+      i += 2
+  return bytes(out)
+
+def build_compressed(file,target):
+  data = b'DFUZ'
+  for image in target:
+    stream = compress(image['data'])
+    if decompress(stream) != image['data']:
+      print("INTERNAL ERROR: compressed stream does not match image")
+      sys.exit(1)
+    print('0x%08x: %d -> %d bytes' % (image['address'],len(image['data']),len(stream)))
+    data += struct.pack('<2I',image['address'],len(stream)) + stream
+  open(file,'wb').write(data)
+
+def build(file,targets,device=DEFAULT_DEVICE,alts=None):
+  data = b''
   for t,target in enumerate(targets):
-    tdata = ''
+    tdata = b''
     for image in target:
       tdata += struct.pack('<2I',image['address'],len(image['data']))+image['data']
-    tdata = struct.pack('<6sBI255s2I','Target',0,1,'ST...',len(tdata),len(target)) + tdata
+    alt = alts[t] if alts else 0
+    tdata = struct.pack('<6sBI255s2I',b'Target',alt,1,b'ST...',len(tdata),len(target)) + tdata
     data += tdata
-  data  = struct.pack('<5sBIB','DfuSe',1,len(data)+11,len(targets)) + data
+  data  = struct.pack('<5sBIB',b'DfuSe',1,len(data)+11,len(targets)) + data
   v,d=map(lambda x: int(x,0) & 0xFFFF, device.split(':',1))
-  data += struct.pack('<4H3sB',0,d,v,0x011a,'UFD',16)
+  data += struct.pack('<4H3sB',0,d,v,0x011a,b'UFD',16)
   crc   = compute_crc(data)
   data += struct.pack('<I',crc)
   open(file,'wb').write(data)
 
+# Intel HEX input, the address space of the PIC18
+PROGRAM_END   = 0x200000   # user IDs and configuration words follow
+EEPROM_START  = 0xF00000
+EEPROM_END    = 0xF00100
+PAGE_SIZE     = 64         # ERASE_PAGE_SIZE of the bootloader
+HEX_GAP       = 2 * PAGE_SIZE
+ERASED        = 0xFF
+
+def read_hex(file):
+  """Bytes of an Intel HEX file as {address: value}"""
+  memory = {}
+  base = 0
+  for n,line in enumerate(open(file)):
+    line = line.strip()
+    if not line:
+      continue
+    record = bytearray(binascii.unhexlify(line[1:])) if line[0] == ':' else bytearray()
+    if len(record) < 5 or len(record) != record[0] + 5 or sum(record) & 0xFF:
+      raise ValueError('%s:%d: invalid Intel HEX record' % (file,n+1))
+    address,rtype,data = record[1] << 8 | record[2],record[3],record[4:-1]
+    if rtype == 0x00:
+      for i,value in enumerate(data):
+        memory[base + address + i] = value
+    elif rtype == 0x01:
+      break
+    elif rtype == 0x02:
+      base = (data[0] << 8 | data[1]) << 4
+    elif rtype == 0x04:
+      base = (data[0] << 8 | data[1]) << 16
+  return memory
+
+def program_elements(memory,gap=HEX_GAP):
+  """Elements of ERASE_PAGE_SIZE aligned pages which hold anything but
+  the erased value. Runs of erased pages shorter than gap bytes are
+  filled in, longer ones split the image."""
+  pages = {}
+  for address,value in memory.items():
+    if address < PROGRAM_END and value != ERASED:
+      page = pages.setdefault(address // PAGE_SIZE,bytearray([ERASED]) * PAGE_SIZE)
+      page[address % PAGE_SIZE] = value
+  elements = []
+  last = None
+  for n in sorted(pages):
+    if last is None or (n - last - 1) * PAGE_SIZE >= gap:
+      elements.append({ 'address': n * PAGE_SIZE, 'data': bytearray() })
+    else:
+      elements[-1]['data'] += bytearray([ERASED]) * ((n - last - 1) * PAGE_SIZE)
+    elements[-1]['data'] += pages[n]
+    last = n
+  return elements
+
+def eeprom_elements(memory):
+  """Contiguous runs of data EEPROM bytes, nothing is erased there"""
+  elements = []
+  for address in sorted(a for a in memory if EEPROM_START <= a < EEPROM_END):
+    if not elements or address != elements[-1]['address'] + len(elements[-1]['data']):
+      elements.append({ 'address': address, 'data': bytearray() })
+    elements[-1]['data'].append(memory[address])
+  return elements
+
+def build_hex(file,hexfile,device=DEFAULT_DEVICE,gap=HEX_GAP):
+  """DfuSe file with the used flash pages of an Intel HEX file for
+  alternate setting 0 and its data EEPROM bytes for alternate setting 1"""
+  memory = read_hex(hexfile)
+  targets,alts = [],[]
+  for alt,elements in enumerate([program_elements(memory,gap),eeprom_elements(memory)]):
+    if elements:
+      for image in elements:
+        image['data'] = bytes(image['data'])
+      targets.append(elements)
+      alts.append(alt)
+  ignored = len([a for a in memory if PROGRAM_END <= a < EEPROM_START or a >= EEPROM_END])
+  if ignored:
+    print('%d bytes of IDs/configuration ignored, they are not written by the bootloader' % ignored)
+  used = len([a for a in memory if a < PROGRAM_END and memory[a] != ERASED])
+  for alt,elements in zip(alts,targets):
+    for image in elements:
+      print('alt %d: 0x%08x, %d bytes' % (alt,image['address'],len(image['data'])))
+  print('%d bytes used, %d bytes in %d elements' % (used,sum(len(i['data']) for t in targets for i in t),sum(len(t) for t in targets)))
+  build(file,targets,device,alts)
+
+def flash(file,device=DEFAULT_DEVICE,timings=None):
+  """Write a DfuSe file with the bootloader and report the time of every
+  phase as one JSON line, appended to the timings file if given"""
+  import json,usbdfu
+  timer = usbdfu.PhaseTimer()
+  elements = usbdfu.read_dfuse(open(file,'rb').read())
+  result = { 'time': int(timer.start), 'file': file, 'device': device,
+    'bytes': sum(len(data) for address,data in elements) }
+  try:
+    if not elements:
+      raise ValueError('No image for alternate setting 0')
+    timer.begin('enumeration')
+    dev = usbdfu.DfuDevice.wait_for(device)
+    result['transfer_size'] = dev.transfer_size
+    result['attributes'] = dev.attributes
+    if not dev.attributes & usbdfu.ATTR_CAN_DNLOAD:
+      raise IOError('Device does not support downloads')
+    dev.flash(elements,timer=timer,verify=True)
+    result['status'] = 'ok'
+  except (IOError,ValueError,usbdfu.DfuError) as e:
+    timer.end()
+    result['status'] = 'error'
+    result['error'] = str(e)
+  total = timer.total()
+  result['phases_ms'] = dict((name,round(t * 1000,1)) for name,t in timer.phases)
+  result['total_ms'] = round(total * 1000,1)
+  result['bytes_per_s'] = int(result['bytes'] / total) if total else 0
+  line = json.dumps(result,sort_keys=True)
+  print(line)
+  if timings:
+    open(timings,'a').write(line + '\n')
+  return result['status'] == 'ok'
+
 if __name__=="__main__":
   usage = """
 %prog [-d|--dump] infile.dfu
-%prog {-b|--build} address:file.bin [-b address:file.bin ...] [{-D|--device}=vendor:device] outfile.dfu"""
+%prog {-b|--build} address:file.bin [-b address:file.bin ...] [{-D|--device}=vendor:device] outfile.dfu
+%prog {-z|--compress} {-b|--build} address:file.bin [-b address:file.bin ...] outfile.dfz
+%prog {-i|--ihex} file.hex [{-g|--gap}=bytes] [{-D|--device}=vendor:device] outfile.dfu
+%prog {-f|--flash} [{-D|--device}=vendor:device] [{-j|--json}=timings.json] infile.dfu"""
   parser = OptionParser(usage=usage)
   parser.add_option("-b", "--build", action="append", dest="binfiles",
     help="build a DFU file from given BINFILES", metavar="BINFILES")
@@ -81,23 +282,41 @@ if __name__=="__main__":
     help="build for DEVICE, defaults to %s" % DEFAULT_DEVICE, metavar="DEVICE")
   parser.add_option("-d", "--dump", action="store_true", dest="dump_images",
     default=False, help="dump contained images to current directory")
+  parser.add_option("-z", "--compress", action="store_true", dest="compress",
+    default=False, help="build a compressed stream for the bootloader")
+  parser.add_option("-i", "--ihex", action="store", dest="hexfile",
+    help="build a sparse DFU file from the used pages of HEXFILE", metavar="HEXFILE")
+  parser.add_option("-g", "--gap", action="store", dest="gap", type="int", default=HEX_GAP,
+    help="split elements at runs of at least BYTES erased bytes, defaults to %d" % HEX_GAP, metavar="BYTES")
+  parser.add_option("-f", "--flash", action="store_true", dest="flash",
+    default=False, help="write a DFU file to the bootloader and print the timing of every phase")
+  parser.add_option("-j", "--json", action="store", dest="json",
+    help="append the timing to FILE, one JSON object per line", metavar="FILE")
   (options, args) = parser.parse_args()
 
-  if options.binfiles and len(args)==1:
+  if options.flash and len(args)==1:
+    if not flash(args[0],options.device or DEFAULT_DEVICE,options.json):
+      sys.exit(1)
+  elif options.hexfile and len(args)==1:
+    if not os.path.isfile(options.hexfile):
+      print("Unreadable file '%s'." % options.hexfile)
+      sys.exit(1)
+    build_hex(args[0],options.hexfile,options.device or DEFAULT_DEVICE,options.gap)
+  elif options.binfiles and len(args)==1:
     target = []
     for arg in options.binfiles:
       try:
         address,binfile = arg.split(':',1)
       except ValueError:
-        print "Address:file couple '%s' invalid." % arg
+        print("Address:file couple '%s' invalid." % arg)
         sys.exit(1)
       try:
         address = int(address,0) & 0xFFFFFFFF
       except ValueError:
-        print "Address %s invalid." % address
+        print("Address %s invalid." % address)
         sys.exit(1)
       if not os.path.isfile(binfile):
-        print "Unreadable file '%s'." % binfile
+        print("Unreadable file '%s'." % binfile)
         sys.exit(1)
       target.append({ 'address': address, 'data': open(binfile,'rb').read() })
     outfile = args[0]
@@ -107,13 +326,16 @@ if __name__=="__main__":
     try:
       v,d=map(lambda x: int(x,0) & 0xFFFF, device.split(':',1))
     except:
-      print "Invalid device '%s'." % device
+      print("Invalid device '%s'." % device)
       sys.exit(1)
-    build(outfile,[target],device)
+    if options.compress:
+      build_compressed(outfile,target)
+    else:
+      build(outfile,[target],device)
   elif len(args)==1:
     infile = args[0]
     if not os.path.isfile(infile):
-      print "Unreadable file '%s'." % infile
+      print("Unreadable file '%s'." % infile)
       sys.exit(1)
     parse(infile, dump_images=options.dump_images)
   else:
@@ -0,0 +1,262 @@
+#!/usr/bin/python
+
+# Gang flasher, writes one DfuSe image to many bootloaders at once
+# Distributed under Gnu LGPL 3.0
+# see http://www.gnu.org/licenses/lgpl-3.0.txt
+
+from __future__ import print_function
+import sys,time,random,threading,struct
+import usbdfu
+from usbdfu import DfuDevice,DfuError
+
+FLASH_START = 0x4000
+FLASH_END   = 0x7FFF
+
+class EmulatedBus:
+  """Shared host controller, transfers are serialized at the full speed data rate"""
+
+  def __init__(self,rate=1000000,frame=0.001):
+    self.lock = threading.Lock()
+    self.rate = rate
+    self.frame = frame
+
+  def transfer(self,length):
+    # setup, data and status stage of a control transfer: 8 + length + overhead
+    with self.lock:
+      time.sleep((8 + length + 32) / float(self.rate))
+    time.sleep(self.frame)
+
+class EmulatedDevice:
+  """Bootloader stand-in with the DfuSe state machine, flash and timing of the device"""
+
+  def __init__(self,bus,serial,fail_rate=0.0):
+    self.bus = bus
+    self.serial = serial
+    self.fail_rate = fail_rate
+    self.flash = bytearray(b'\xff' * (FLASH_END + 1))
+    self.state = usbdfu.dfuIDLE
+    self.status = 0
+    self.address = 0
+    self.timeout = 0
+    self.busy_until = 0
+    self.pending = None
+    self.error_address = 0
+
+  def set_interface_altsetting(self,interface,alternate_setting):
+    pass
+
+  def ctrl_transfer(self,bmRequestType,bRequest,wValue,wIndex,data_or_wLength=None,timeout=None):
+    if self.state == usbdfu.appIDLE:
+      raise IOError('device %s disconnected' % self.serial)
+    if bmRequestType & 0x80:
+      length = data_or_wLength
+    else:
+      length = len(data_or_wLength) if data_or_wLength else 0
+    self.bus.transfer(length)
+    if random.random() < self.fail_rate:
+      raise IOError('device %s: emulated transfer error' % self.serial)
+    if bmRequestType == 0xC0:
+      return self.vendor(bRequest,wValue,wIndex,length)
+    if bRequest == usbdfu.DFU_DNLOAD:
+      self.dnload(wValue,bytearray(data_or_wLength or b''))
+    elif bRequest == usbdfu.DFU_GETSTATUS:
+      return self.get_status()
+    elif bRequest == usbdfu.DFU_GETSTATE:
+      return bytearray([self.state])
+    elif bRequest == usbdfu.DFU_CLRSTATUS:
+      self.state,self.status = usbdfu.dfuIDLE,0
+    elif bRequest == usbdfu.DFU_ABORT:
+      self.state = usbdfu.dfuIDLE
+    else:
+      self.error(15)
+    return length
+
+  def vendor(self,bRequest,wValue,wIndex,length):
+    if bRequest == usbdfu.VENDOR_GET_ERROR:
+      return bytearray([self.status]) + bytearray(struct.pack('<I',self.error_address))
+    if bRequest != usbdfu.VENDOR_GET_PAGE_CRC or wIndex == 0:
+      raise IOError('device %s: request stalled' % self.serial)
+    address,size = wValue * usbdfu.PAGE_SIZE,wIndex * usbdfu.PAGE_SIZE
+    if address < FLASH_START or address + size * (length // 2) > FLASH_END + 1:
+      raise IOError('device %s: request stalled' % self.serial)
+    # TBLRD loop with the CRC update, about 2 us per byte
+    time.sleep(size * (length // 2) * 2e-6)
+    crcs = [usbdfu.crc16(self.flash[a:a+size]) for a in range(address,address + size * (length // 2),size)]
+    return bytearray(b''.join(bytes(bytearray([c & 0xFF,c >> 8])) for c in crcs))
+
+  def error(self,status):
+    self.state,self.status = usbdfu.dfuERROR,status
+
+  def dnload(self,block,data):
+    if self.state not in (usbdfu.dfuIDLE,usbdfu.dfuDNLOAD_IDLE):
+      self.error(15)
+    elif not data:
+      self.state = usbdfu.dfuMANIFEST_SYNC if self.state == usbdfu.dfuDNLOAD_IDLE else usbdfu.dfuERROR
+    else:
+      self.state = usbdfu.dfuDNLOAD_SYNC
+      self.pending = (block,data)
+
+  def execute(self,block,data):
+    """Returns the poll timeout of the operation in ms"""
+    if block == 0 and data[0] == usbdfu.SET_ADDRESS_TOKEN and len(data) == 5:
+      self.address = data[1] | data[2] << 8 | data[3] << 16 | data[4] << 24
+      return 0
+    if block == 0 and data[0] == usbdfu.ERASE_PAGE_TOKEN:
+      if len(data) == 1:
+        self.flash[FLASH_START:] = b'\xff' * (FLASH_END + 1 - FLASH_START)
+        return 0x4ff
+      page = (data[1] | data[2] << 8 | data[3] << 16 | data[4] << 24) & ~(usbdfu.PAGE_SIZE - 1)
+      if page < FLASH_START or page > FLASH_END:
+        self.error(8)
+      else:
+        self.flash[page:page+usbdfu.PAGE_SIZE] = b'\xff' * usbdfu.PAGE_SIZE
+      return 2
+    if block == 0 and data[0] == usbdfu.ERASE_RANGE_TOKEN and len(data) == 7:
+      page = (data[1] | data[2] << 8 | data[3] << 16 | data[4] << 24) & ~(usbdfu.PAGE_SIZE - 1)
+      count = data[5] | data[6] << 8
+      if page < FLASH_START or page + count * usbdfu.PAGE_SIZE - 1 > FLASH_END:
+        self.error_address = max(page,FLASH_END + 1)
+        self.error(8)
+        return 0
+      self.flash[page:page+count*usbdfu.PAGE_SIZE] = b'\xff' * (count * usbdfu.PAGE_SIZE)
+      return count * 5
+    if block == 0:
+      self.error(15)
+      return 0
+    if self.address < FLASH_START or self.address + len(data) - 1 > FLASH_END:
+      self.error_address = self.address
+      self.error(8)
+      return 0
+    for i,b in enumerate(data):
+      self.flash[self.address + i] &= b
+      # read back verification, bits can only be cleared without an erase
+      if self.flash[self.address + i] != b:
+        self.error_address = self.address + i
+        self.error(6 if self.flash[self.address + i] == 0xFF else 7)
+        break
+    return 4
+
+  def get_status(self):
+    now = time.time()
+    if self.state == usbdfu.dfuDNLOAD_SYNC:
+      self.timeout = self.execute(*self.pending)
+      self.busy_until = now + self.timeout / 1000.0
+      if self.state != usbdfu.dfuERROR:
+        self.state = usbdfu.dfuDNBUSY
+    elif self.state == usbdfu.dfuDNBUSY and now >= self.busy_until:
+      self.state,self.timeout = usbdfu.dfuDNLOAD_IDLE,0
+    elif self.state == usbdfu.dfuMANIFEST_SYNC:
+      self.state,self.timeout = usbdfu.dfuMANIFEST,0x40
+    elif self.state == usbdfu.dfuMANIFEST:
+      # the application is started, the device leaves the bus
+      self.state = usbdfu.appIDLE
+      raise IOError('device %s disconnected' % self.serial)
+    t = self.timeout
+    return bytearray([self.status,t & 0xFF,(t >> 8) & 0xFF,0,self.state,0])
+
+class Worker(threading.Thread):
+  """Flashes one device, restarting the whole image after an error"""
+
+  def __init__(self,name,device,elements,retries,diff=False):
+    threading.Thread.__init__(self)
+    self.daemon = True
+    self.name = name
+    self.device = device
+    self.elements = elements
+    self.retries = retries
+    self.diff = diff
+    self.total = sum(len(d) for a,d in elements)
+    self.done = 0
+    self.attempt = 0
+    self.error = None
+    self.state = 'waiting'
+
+  def progress(self,length):
+    self.done += length
+
+  def run(self):
+    while self.attempt <= self.retries:
+      self.attempt += 1
+      self.done = 0
+      self.state = 'flashing'
+      try:
+        self.recover()
+        if self.diff:
+          self.device.flash_diff(self.elements,self.progress)
+          self.done = self.total
+        else:
+          self.device.flash(self.elements,self.progress)
+        self.state = 'done'
+        return
+      except (IOError,DfuError) as e:
+        self.error = str(e)
+        self.state = 'retry'
+    self.state = 'failed'
+
+  def recover(self):
+    """Bring the device back to dfuIDLE after a failed attempt"""
+    if self.attempt > 1:
+      status,timeout,state = self.device.get_status()
+      if state == usbdfu.dfuERROR:
+        self.device.clr_status()
+      elif state != usbdfu.dfuIDLE:
+        self.device.abort()
+
+def report(workers,start,final=False):
+  done = sum(w.done for w in workers)
+  elapsed = max(time.time() - start,1e-6)
+  line = ' '.join('%s:%3d%%' % (w.name,100 * w.done // max(w.total,1)) if w.state != 'failed' else '%s:FAIL' % w.name for w in workers)
+  print('\r%s %6.1f kB/s' % (line,done / elapsed / 1024),end='\n' if final else '')
+  sys.stdout.flush()
+
+def gang(devices,elements,retries=2,diff=False,interval=0.5):
+  workers = [Worker(name,dev,elements,retries,diff) for name,dev in devices]
+  start = time.time()
+  for w in workers:
+    w.start()
+  while any(w.is_alive() for w in workers):
+    report(workers,start)
+    time.sleep(interval)
+  report(workers,start,final=True)
+  for w in workers:
+    if w.attempt > 1 or w.state == 'failed':
+      print('%s: %s after %d attempt(s), last error: %s' % (w.name,w.state,w.attempt,w.error))
+  return workers
+
+if __name__=="__main__":
+  from optparse import OptionParser
+  parser = OptionParser(usage="%prog [{-D|--device}=vendor:device] [{-e|--emulate}=count] infile.dfu")
+  parser.add_option("-D", "--device", action="store", dest="device",
+    default=usbdfu.DEFAULT_DEVICE, help="vendor:device of the bootloaders", metavar="DEVICE")
+  parser.add_option("-e", "--emulate", action="store", dest="emulate", type="int", default=0,
+    help="flash COUNT emulated devices instead of real ones", metavar="COUNT")
+  parser.add_option("-f", "--fail-rate", action="store", dest="fail_rate", type="float", default=0.0,
+    help="probability of an emulated transfer error", metavar="RATE")
+  parser.add_option("-r", "--retries", action="store", dest="retries", type="int", default=2,
+    help="attempts per device after the first one fails", metavar="COUNT")
+  parser.add_option("-d", "--diff", action="store_true", dest="diff", default=False,
+    help="write only the pages which differ from flash")
+  (options, args) = parser.parse_args()
+  if len(args) != 1:
+    parser.print_help()
+    sys.exit(1)
+  elements = usbdfu.read_dfuse(open(args[0],'rb').read())
+  if not elements:
+    print("No image for alternate setting 0 in %s" % args[0])
+    sys.exit(1)
+  if options.emulate:
+    bus = EmulatedBus()
+    devices = [('emu%d' % i,DfuDevice(EmulatedDevice(bus,i,options.fail_rate))) for i in range(options.emulate)]
+  else:
+    devices = [('%d-%d' % (d.dev.bus,d.dev.address),d) for d in DfuDevice.find(options.device,find_all=True)]
+  if not devices:
+    print("No device found")
+    sys.exit(1)
+  workers = gang(devices,elements,options.retries,options.diff)
+  if options.emulate:
+    for (name,d),w in zip(devices,workers):
+      for address,data in elements:
+        if w.state == 'done' and bytes(d.dev.flash[address:address+len(data)]) != data:
+          print('%s: VERIFY ERROR at 0x%04x' % (name,address))
+          w.state = 'failed'
+  sys.exit(0 if all(w.state == 'done' for w in workers) else 1)
@@ -0,0 +1,204 @@
+#!/usr/bin/python
+
+# Binary delta patches for the PIC18F DFU bootloader
+# Distributed under Gnu LGPL 3.0
+# see http://www.gnu.org/licenses/lgpl-3.0.txt
+#
+# A patch turns the image in flash (old) into a new image. Both images
+# start at the application entry. Changed pages are encoded with
+# LITERAL and COPY operations, unchanged pages are skipped with SEEK.
+# The bootloader writes the pages in address order, so COPY may only
+# read from the page being written or from pages above.
+#
+# File: 'DFUP', crc16 (2), length (2) of the old image, operations
+#
+# With the bootloader at the top of flash (LAYOUT=top) the first 4 bytes
+# in flash are a goto to the bootloader instead of the reset vector of
+# the image, --top makes the patch for that flash content.
+
+from __future__ import print_function
+import sys,struct,binascii,os
+from optparse import OptionParser
+from usbdfu import boot_vector
+
+PAGE_SIZE   = 64
+MIN_MATCH   = 4
+MAX_LITERAL = 128
+MAX_COPY    = 127
+COPY        = 0x80
+SEEK        = 0xFF
+
+def crc16(data):
+  return binascii.crc_hqx(bytes(data),0xFFFF)
+
+def index_image(old):
+  seeds = {}
+  for i in range(len(old)-MIN_MATCH+1):
+    seeds.setdefault(bytes(old[i:i+MIN_MATCH]),[]).append(i)
+  return seeds
+
+def find_match(old,seeds,new,pos,limit,floor):
+  best_len,best_src = 0,0
+  for src in seeds.get(bytes(new[pos:pos+MIN_MATCH]),()):
+    if src < floor:
+      continue
+    n = 0
+    while pos+n < limit and src+n < len(old) and n < MAX_COPY and old[src+n] == new[pos+n]:
+      n += 1
+    if n > best_len:
+      best_len,best_src = n,src
+      if n == MAX_COPY:
+        break
+  return best_len,best_src
+
+def make(old,new,page_size=PAGE_SIZE):
+  old = bytearray(old)
+  new = bytearray(new)
+  if len(new) < len(old):
+    # erase the rest of the old image
+    new += bytearray([0xFF] * (len(old)-len(new)))
+  padded = old + bytearray([0xFF] * (len(new)-len(old)))
+  seeds = index_image(old)
+  ops = bytearray()
+  out = 0
+  for base in range(0,len(new),page_size):
+    end = min(base+page_size,len(new))
+    if new[base:end] == padded[base:end]:
+      continue
+    if out != base:
+      ops += struct.pack('<BH',SEEK,base)
+    literal = bytearray()
+    pos = base
+    while pos < end:
+      n,src = find_match(old,seeds,new,pos,end,base)
+      if n < MIN_MATCH:
+        literal.append(new[pos])
+        pos += 1
+        if len(literal) == MAX_LITERAL:
+          ops.append(len(literal)-1)
+          ops += literal
+          literal = bytearray()
+        continue
+      if literal:
+        ops.append(len(literal)-1)
+        ops += literal
+        literal = bytearray()
+      ops += struct.pack('<BH',COPY+n-1,src)
+      pos += n
+    if literal:
+      ops.append(len(literal)-1)
+      ops += literal
+    out = end
+  return struct.pack('<4sHH',b'DFUP',crc16(old),len(old)) + bytes(ops)
+
+def apply(old,patch,length=0,page_size=PAGE_SIZE):
+  """Reference decoder, behaves like the bootloader
+
+  Flash behind the old image is erased, length is the size of the new
+  image if it grows."""
+  old = bytearray(old)
+  size = max(len(old),length)
+  size += -size % page_size
+  flash = old + bytearray([0xFF] * (size-len(old)))
+  ops = bytearray(patch[8:])
+  out = bytearray()
+  base = 0
+  page = flash[0:page_size]
+  pos = 0
+  def flush():
+    flash[base:base+len(page)] = page
+  i = 0
+  while i < len(ops):
+    op = ops[i]
+    if op < COPY:
+      data = ops[i+1:i+op+2]
+      i += op+2
+    else:
+      arg = ops[i+1] | ops[i+2] << 8
+      i += 3
+      if op == SEEK:
+        assert arg >= base+pos
+        if pos or page != flash[base:base+page_size]:
+          flush()
+        base = arg - arg % page_size
+        page = flash[base:base+page_size]
+        pos = arg - base
+        continue
+      assert arg >= base, 'COPY from overwritten page'
+      data = flash[arg:arg+op-COPY+1]
+    for b in data:
+      page[pos] = b
+      pos += 1
+      if pos == page_size:
+        flush()
+        base += page_size
+        page = flash[base:base+page_size]
+        pos = 0
+  flush()
+  return flash
+
+def self_test():
+  """Round trips of shrinking, equal and growing images"""
+  import random
+  rnd = random.Random(1)
+  def image(n):
+    return bytearray(rnd.randrange(256) for i in range(n))
+  old = image(1000)
+  grown = old[:300] + image(40) + old[300:] + image(700)
+  cases = [
+    ('equal', old, bytearray(old)),
+    ('shrink', old, old[:500]),
+    ('grow', old, old + image(900)),
+    ('grow unaligned', old[:70], grown),
+    ('from empty', bytearray(), image(130)),
+    ('top', boot_vector() + old[4:], grown),
+  ]
+  failed = 0
+  for name,a,b in cases:
+    patch = make(a,b)
+    result = apply(a,patch,len(b))
+    ok = result == b + bytearray([0xFF] * (len(result)-len(b)))
+    print("%-16s %s (patch %d bytes)" % (name,"ok" if ok else "FAILED",len(patch)))
+    failed += not ok
+  return failed
+
+if __name__=="__main__":
+  usage = """
+%prog [{-t|--top}] old.bin new.bin outfile.patch
+%prog {-s|--send} [{-D|--device}=vendor:device] infile.patch
+%prog --self-test"""
+  parser = OptionParser(usage=usage)
+  parser.add_option("-s", "--send", action="store_true", dest="send",
+    default=False, help="send a patch to the bootloader")
+  parser.add_option("-D", "--device", action="store", dest="device",
+    default="0x0483:0xdf11", help="vendor:device of the bootloader", metavar="DEVICE")
+  parser.add_option("-t", "--top", action="store_true", dest="top",
+    default=False, help="the bootloader is at the top of flash (LAYOUT=top)")
+  parser.add_option("--self-test", action="store_true", dest="self_test",
+    default=False, help="check the encoder against the reference decoder")
+  (options, args) = parser.parse_args()
+
+  if options.self_test:
+    sys.exit(1 if self_test() else 0)
+  elif options.send and len(args)==1:
+    from usbdfu import DfuDevice
+    DfuDevice.find(options.device).send(open(args[0],'rb').read())
+  elif len(args)==3:
+    for f in args[:2]:
+      if not os.path.isfile(f):
+        print("Unreadable file '%s'." % f)
+        sys.exit(1)
+    old = open(args[0],'rb').read()
+    if options.top:
+      old = boot_vector() + old[4:]
+    new = open(args[1],'rb').read()
+    patch = make(old,new)
+    result = apply(old,patch,len(new))
+    if result[:len(new)] != bytearray(new):
+      print("INTERNAL ERROR: patch does not reproduce new image")
+      sys.exit(1)
+    open(args[2],'wb').write(patch)
+    print("%s: %d bytes (image %d bytes)" % (args[2],len(patch),len(new)))
+  else:
+    parser.print_help()
+    sys.exit(1)
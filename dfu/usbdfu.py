@@ -0,0 +1,520 @@
+#!/usr/bin/python
+
+# Host side of the PIC18F DFU bootloader protocol (DfuSe 1.1a)
+# Distributed under Gnu LGPL 3.0
+# see http://www.gnu.org/licenses/lgpl-3.0.txt
+
+from __future__ import print_function
+import sys,struct,time,binascii
+
+DEFAULT_DEVICE="0x0483:0xdf11"
+
+# DFU requests
+DFU_DETACH    = 0
+DFU_DNLOAD    = 1
+DFU_UPLOAD    = 2
+DFU_GETSTATUS = 3
+DFU_CLRSTATUS = 4
+DFU_GETSTATE  = 5
+DFU_ABORT     = 6
+
+# DFU states
+appIDLE                = 0
+appDETACH              = 1
+dfuIDLE                = 2
+dfuDNLOAD_SYNC         = 3
+dfuDNBUSY              = 4
+dfuDNLOAD_IDLE         = 5
+dfuMANIFEST_SYNC       = 6
+dfuMANIFEST            = 7
+dfuMANIFEST_WAIT_RESET = 8
+dfuUPLOAD_IDLE         = 9
+dfuERROR               = 10
+
+# Flash erase page size
+PAGE_SIZE = 64
+
+# LAYOUT=top: the application starts at 0, the bootloader keeps a goto to
+# itself at 0 and moves the reset vector of the application to APP_RESET
+TOP_BOOT_START = 0x4000
+TOP_APP_RESET  = 0x3FFC
+
+# bmAttributes of the DFU functional descriptor
+ATTR_CAN_DNLOAD          = 0x01
+ATTR_CAN_UPLOAD          = 0x02
+ATTR_MANIFEST_TOLERANT   = 0x04
+ATTR_WILL_DETACH         = 0x08
+
+# Vendor requests
+VENDOR_GET_JOURNAL  = 0x01
+VENDOR_GET_PAGE_CRC = 0x02
+VENDOR_GET_ERROR    = 0x03
+VENDOR_GET_STATS    = 0x04
+VENDOR_GET_BRINGUP  = 0x05
+STATS_SLOTS         = 4
+STATS_OPEN          = 0x01
+PAGE_CRC_COUNT      = 16   # CRCs per request, one EP0 packet
+PAGE_CRC_BLOCK      = 16   # pages per CRC of the coarse pass, 1 KB
+BRINGUP_MILESTONES  = ('decided','attached','reset','descriptor','address','configured','dfu')
+BRINGUP_TICK_US     = 256 / 12.0   # Timer0 tick, 1:256 at 48 MHz
+BRINGUP_NONE        = 0xFFFF
+
+# DfuSe command tokens
+GET_COMMAND_TOKEN = 0x00
+SET_ADDRESS_TOKEN = 0x21
+ERASE_PAGE_TOKEN  = 0x41
+ERASE_RANGE_TOKEN = 0x43
+PATCH_TOKEN       = 0x50
+COMPRESSED_TOKEN  = 0x51
+
+# Bulk transfer interface
+BULK_INTERFACE   = 1
+BULK_OUT         = 0x01
+BULK_IN          = 0x81
+BULK_PACKET_SIZE = 64
+BULK_PACKETS     = 8     # data packets per write frame
+BULK_WINDOW      = 8
+BULK_PAGE_SIZE   = 64
+BULK_WRITE       = 0x01
+BULK_ERASE       = 0x02
+BULK_SYNC        = 0x03
+BULK_CLEAR       = 0x04
+
+STATUS_NAMES = ['OK','errTARGET','errFILE','errWRITE','errERASE',
+  'errCHECK_ERASED','errPROG','errVERIFY','errADDRESS','errNOTDONE',
+  'errFIRMWARE','errVENDOR','errUSBR','errPOR','errUNKNOWN','errSTALLEDPKT']
+
+class DfuError(Exception):
+  def __init__(self,status,state,address=None):
+    message = '%s in state %d' % (STATUS_NAMES[status & 0x0F],state)
+    if address is not None:
+      message += ' at 0x%06x' % address
+    Exception.__init__(self,message)
+    self.status = status
+    self.state = state
+    self.address = address
+
+class PhaseTimer:
+  """Wall clock time of the phases of an update, in the order they ran"""
+
+  def __init__(self):
+    self.start = time.time()
+    self.phases = []
+    self.current = None
+
+  def begin(self,name):
+    self.end()
+    self.current = (name,time.time())
+
+  def end(self):
+    if self.current:
+      name,start = self.current
+      self.phases.append((name,time.time() - start))
+      self.current = None
+
+  def total(self):
+    return time.time() - self.start
+
+def parse_device(device):
+  return [int(x,0) & 0xFFFF for x in device.split(':',1)]
+
+def crc16(data):
+  """CRC-16/CCITT-FALSE as computed by the bootloader"""
+  return binascii.crc_hqx(bytes(data),0xFFFF)
+
+def boot_vector(boot_start=TOP_BOOT_START):
+  """goto boot_start, as written to 0x0000 by the bootloader"""
+  return bytes(bytearray([(boot_start >> 1) & 0xFF,0xEF,(boot_start >> 9) & 0xFF,0xF0 | ((boot_start >> 17) & 0x0F)]))
+
+def element_image(address,data):
+  """Page aligned start and content of an element, the rest of the first and last page is erased"""
+  start = address & ~(PAGE_SIZE - 1)
+  end = (address + len(data) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1)
+  image = bytearray(b'\xff' * (end - start))
+  image[address - start:address - start + len(data)] = data
+  return start,image
+
+def top_layout(elements):
+  """The elements are an application at 0 (LAYOUT=top)"""
+  return any(address < TOP_BOOT_START for address,data in elements)
+
+def expected_flash(elements,manifested=False):
+  """(start, image) of the elements as the device keeps them in flash.
+  With LAYOUT=top page 0 starts with the goto to the bootloader, after
+  the manifestation the reset vector of the image is at APP_RESET"""
+  images = [element_image(address,data) for address,data in elements]
+  if not top_layout(elements):
+    return images
+  reset = None
+  for start,image in images:
+    if start == 0:
+      reset = bytes(image[:4])
+      image[:4] = boot_vector()
+  if manifested and reset is not None:
+    for start,image in images:
+      if start <= TOP_APP_RESET < start + len(image):
+        image[TOP_APP_RESET - start:TOP_APP_RESET - start + 4] = reset
+        break
+    else:
+      # the page below the bootloader is not used by the image
+      page = bytearray(b'\xff' * PAGE_SIZE)
+      page[TOP_APP_RESET % PAGE_SIZE:TOP_APP_RESET % PAGE_SIZE + 4] = reset
+      images.append((TOP_APP_RESET & ~(PAGE_SIZE - 1),page))
+  return images
+
+def read_dfuse(data,alt=0):
+  """Elements (address, data) of the targets for alt in a DfuSe file made by dfu.py"""
+  data = bytearray(data)
+  signature,version,size,targets = struct.unpack('<5sBIB',bytes(data[:11]))
+  if signature != b'DfuSe':
+    raise ValueError('Not a DfuSe file')
+  data = data[11:]
+  elements = []
+  for t in range(targets):
+    tsignature,altsetting,named,name,tsize,count = struct.unpack('<6sBI255s2I',bytes(data[:274]))
+    target,data = data[274:274+tsize],data[274+tsize:]
+    for e in range(count):
+      address,esize = struct.unpack('<2I',bytes(target[:8]))
+      if altsetting == alt:
+        elements.append((address,bytes(target[8:8+esize])))
+      target = target[8+esize:]
+  return elements
+
+class DfuDevice:
+  """One bootloader, all requests go to interface 0"""
+
+  def __init__(self,dev,alt=0,transfer_size=None):
+    self.dev = dev
+    self.attributes,self.detach_timeout,size = self.functional_descriptor() or (0x0B,255,None)
+    self.transfer_size = transfer_size or size or 32
+    self.block = 2
+    if alt:
+      dev.set_interface_altsetting(interface=0,alternate_setting=alt)
+
+  def functional_descriptor(self):
+    """bmAttributes, wDetachTimeOut and wTransferSize of the DFU functional descriptor"""
+    try:
+      for intf in self.dev.get_active_configuration():
+        extra = bytearray(intf.extra_descriptors)
+        if len(extra) >= 7 and extra[1] == 0x21:
+          return extra[2],extra[3] | extra[4] << 8,extra[5] | extra[6] << 8
+    except (AttributeError,IOError):
+      pass
+    return None
+
+  @classmethod
+  def wait_for(cls,device=DEFAULT_DEVICE,timeout=10.0,**kw):
+    """Wait until the bootloader enumerates, e.g. after plugging in a board"""
+    deadline = time.time() + timeout
+    while True:
+      try:
+        return cls.find(device,**kw)
+      except IOError:
+        if time.time() >= deadline:
+          raise
+        time.sleep(0.05)
+
+  @classmethod
+  def find(cls,device=DEFAULT_DEVICE,find_all=False,**kw):
+    import usb.core
+    v,p = parse_device(device)
+    if find_all:
+      return [cls(d,**kw) for d in usb.core.find(idVendor=v,idProduct=p,find_all=True)]
+    d = usb.core.find(idVendor=v,idProduct=p)
+    if d is None:
+      raise IOError('No device %s found' % device)
+    return cls(d,**kw)
+
+  def dnload(self,block,data):
+    self.dev.ctrl_transfer(0x21,DFU_DNLOAD,block,0,data)
+
+  def upload(self,block,length):
+    return bytearray(self.dev.ctrl_transfer(0xA1,DFU_UPLOAD,block,0,length))
+
+  def get_status(self):
+    s = bytearray(self.dev.ctrl_transfer(0xA1,DFU_GETSTATUS,0,0,6))
+    return s[0], s[1] | s[2] << 8 | s[3] << 16, s[4]
+
+  def get_state(self):
+    return bytearray(self.dev.ctrl_transfer(0xA1,DFU_GETSTATE,0,0,1))[0]
+
+  def clr_status(self):
+    self.dev.ctrl_transfer(0x21,DFU_CLRSTATUS,0,0,None)
+
+  def abort(self):
+    self.dev.ctrl_transfer(0x21,DFU_ABORT,0,0,None)
+
+  def vendor_in(self,request,length,value=0,index=0):
+    return bytearray(self.dev.ctrl_transfer(0xC0,request,value,index,length))
+
+  def error_address(self,status):
+    """Failing address of a write or verify error, the block is checked after programming"""
+    if status not in (3,6,7,8):
+      return None
+    error = self.vendor_in(VENDOR_GET_ERROR,5)
+    return struct.unpack('<I',bytes(error[1:5]))[0]
+
+  def stats(self):
+    """Update statistics of the device, newest session first"""
+    records = []
+    for age in range(STATS_SLOTS):
+      data = self.vendor_in(VENDOR_GET_STATS,15,age)
+      if len(data) < 15:
+        break
+      written,erased,elapsed,error,flags,interrupted,session = struct.unpack('<IHIBBBH',bytes(data[:15]))
+      records.append({'session':session,'written':written,'erased':erased,'elapsed_ms':elapsed,
+        'error':error,'open':bool(flags & STATS_OPEN),'interrupted':interrupted})
+    return records
+
+  def bringup_times(self):
+    """Milestones of the bring-up in us from main, None if not reached"""
+    data = self.vendor_in(VENDOR_GET_BRINGUP,2 * len(BRINGUP_MILESTONES))
+    ticks = struct.unpack('<%dH' % (len(data) // 2),bytes(data))
+    return [(name,None if t == BRINGUP_NONE else t * BRINGUP_TICK_US)
+      for name,t in zip(BRINGUP_MILESTONES,ticks)]
+
+  def wait(self,until=(dfuDNLOAD_IDLE,)):
+    """Poll GETSTATUS until one of the states is reached, the next poll
+    follows bwPollTimeout after the status arrived, not after our own work"""
+    while True:
+      status,timeout,state = self.get_status()
+      ready = time.time() + timeout / 1000.0
+      if status:
+        raise DfuError(status,state,self.error_address(status))
+      if state in until:
+        return state
+      delay = ready - time.time()
+      if delay > 0:
+        time.sleep(delay)
+
+  def command(self,data):
+    self.dnload(0,bytes(bytearray(data)))
+    self.wait()
+
+  def set_address(self,address):
+    self.command(struct.pack('<BI',SET_ADDRESS_TOKEN,address))
+
+  def erase_page(self,address):
+    self.command(struct.pack('<BI',ERASE_PAGE_TOKEN,address))
+
+  def erase_range(self,address,count):
+    """Erase count pages from address on in one busy period, at most one flash size"""
+    self.command(struct.pack('<BIH',ERASE_RANGE_TOKEN,address,count))
+
+  def mass_erase(self):
+    self.command(struct.pack('<B',ERASE_PAGE_TOKEN))
+
+  def write(self,data):
+    """Download data in blocks of transfer_size at the current address/stream"""
+    data = bytearray(data)
+    for i in range(0,len(data),self.transfer_size):
+      self.dnload(self.block,bytes(data[i:i+self.transfer_size]))
+      self.block = self.block + 1 if self.block < 0xFFFF else 2
+      self.wait()
+
+  def download(self,address,data,progress=None):
+    """Write data with a SET_ADDRESS for every block, like dfu-util does.
+    All requests are built first, the next one leaves as soon as the
+    status of the previous one allows it"""
+    data = bytearray(data)
+    blocks = [(struct.pack('<BI',SET_ADDRESS_TOKEN,address + i),bytes(data[i:i+self.transfer_size]))
+      for i in range(0,len(data),self.transfer_size)]
+    for command,block in blocks:
+      self.dnload(0,command)
+      self.wait()
+      self.dnload(2,block)
+      self.wait()
+      if progress:
+        progress(len(block))
+
+  def verify(self,elements,manifested=False):
+    """Page addresses of the elements which differ from flash, by page CRC"""
+    changed = []
+    for start,image in expected_flash(elements,manifested):
+      changed += self.changed_pages(start,image)
+    return changed
+
+  def flash(self,elements,progress=None,timer=None,verify=False):
+    """Erase the pages of all (address, data) elements, write and manifest them"""
+    timer = timer or PhaseTimer()
+    timer.begin('erase')
+    for address,data in elements:
+      start = address & ~(PAGE_SIZE - 1)
+      self.erase_range(start,(address + len(data) - start + PAGE_SIZE - 1) // PAGE_SIZE)
+    timer.begin('download')
+    for address,data in elements:
+      self.download(address,data,progress)
+    if verify:
+      timer.begin('verify')
+      changed = self.verify(elements)
+      if changed:
+        timer.end()
+        raise IOError('%d pages differ after the download, first at 0x%06x' % (len(changed),changed[0]))
+    timer.begin('manifest')
+    self.set_address(elements[0][0])
+    self.manifest()
+    timer.end()
+
+  def page_crcs(self,address,pages,count):
+    """CRCs of count blocks, each of the given number of erase pages, from address on"""
+    crcs = self.vendor_in(VENDOR_GET_PAGE_CRC,2 * count,address // PAGE_SIZE,pages)
+    return list(struct.unpack('<%dH' % count,bytes(crcs)))
+
+  def changed_pages(self,address,data):
+    """Page addresses where data (page aligned) differs from flash, 1 KB blocks first"""
+    changed = []
+    block = PAGE_CRC_BLOCK * PAGE_SIZE
+    blocks = []
+    for i in range(0,len(data),block * PAGE_CRC_COUNT):
+      count = min(PAGE_CRC_COUNT,(len(data) - i + block - 1) // block)
+      if len(data) - i < block * count:
+        # the last block is shorter, compare its pages one by one
+        count -= 1
+        blocks.append(address + i + block * count)
+      for n,crc in enumerate(self.page_crcs(address + i,PAGE_CRC_BLOCK,count) if count else []):
+        if crc != crc16(data[i + n * block:i + (n + 1) * block]):
+          blocks.append(address + i + n * block)
+    for start in sorted(blocks):
+      offset = start - address
+      count = min(PAGE_CRC_BLOCK,(len(data) - offset) // PAGE_SIZE)
+      for n,crc in enumerate(self.page_crcs(start,1,count)):
+        page = offset + n * PAGE_SIZE
+        if crc != crc16(data[page:page + PAGE_SIZE]):
+          changed.append(address + page)
+    return changed
+
+  def flash_diff(self,elements,progress=None):
+    """Write only the pages which differ from flash, returns the number of pages written"""
+    changed = set(self.verify(elements,manifested=True))
+    if top_layout(elements) and TOP_APP_RESET & ~(PAGE_SIZE - 1) in changed:
+      # the bootloader takes a new reset vector only from page 0
+      changed.add(0)
+    written = 0
+    for page in sorted(changed):
+      for start,image in (element_image(address,data) for address,data in elements):
+        if start <= page < start + len(image):
+          self.erase_page(page)
+          self.download(page,image[page - start:page - start + PAGE_SIZE],progress)
+          written += 1
+          break
+    if written:
+      self.manifest()
+    return written
+
+  def manifest(self):
+    """Zero length DNLOAD, the device verifies the image and starts it.
+    A failed verification (errVERIFY, errFIRMWARE) raises DfuError"""
+    self.dnload(0,None)
+    # only a manifestation tolerant device comes back to dfuIDLE, the
+    # others stay in dfuMANIFEST until they leave the bus
+    until = (dfuIDLE,) if self.attributes & ATTR_MANIFEST_TOLERANT else (dfuMANIFEST_WAIT_RESET,dfuIDLE)
+    try:
+      self.wait(until)
+    except IOError:
+      # the device left the bootloader
+      pass
+
+  def patch(self,patch):
+    """Send a patch made by patch.py"""
+    magic,crc,length = struct.unpack('<4sHH',bytes(patch[:8]))
+    if magic != b'DFUP':
+      raise ValueError('Not a patch file')
+    self.command(struct.pack('<BHH',PATCH_TOKEN,crc,length))
+    self.write(patch[8:])
+
+  def compressed(self,address,stream):
+    """Send one element of a compressed image made by dfu.py -z"""
+    self.command(struct.pack('<BI',COMPRESSED_TOKEN,address))
+    self.write(stream)
+
+  def bulk_frame(self,op,seq,address,length=0,data=b''):
+    self.dev.write(BULK_OUT,struct.pack('<BBI',op,seq & 0xFF,address)[:5] + struct.pack('<B',length))
+    if data:
+      # length full packets, no short packet ends the transfer
+      self.dev.write(BULK_OUT,bytes(data))
+
+  def bulk_ack(self,seq):
+    """Read one acknowledge, status, last seq, address"""
+    ack = bytearray(self.dev.read(BULK_IN,8,timeout=5000))
+    if ack[0]:
+      self.bulk_frame(BULK_CLEAR,0,0)
+      raise IOError('%s at 0x%06X' % (STATUS_NAMES[ack[0] & 0x0F],ack[2] | ack[3] << 8 | ack[4] << 16))
+    if ack[1] != seq & 0xFF:
+      raise IOError('Bulk acknowledge out of sequence')
+
+  def bulk_download(self,address,data):
+    """Erase and write data through the bulk interface, acknowledged every BULK_WINDOW frames"""
+    import usb.util
+    usb.util.claim_interface(self.dev,BULK_INTERFACE)
+    # Whole data packets, the padding is written to erased pages
+    start = address & ~(BULK_PACKET_SIZE - 1)
+    data = bytearray([0xFF] * (address - start)) + bytearray(data)
+    data += bytearray([0xFF] * (-len(data) % BULK_PACKET_SIZE))
+    frames = []
+    pages = (len(data) + BULK_PAGE_SIZE - 1) // BULK_PAGE_SIZE
+    for i in range(0,pages,255):
+      frames.append((BULK_ERASE,start + i * BULK_PAGE_SIZE,min(255,pages - i),b''))
+    for i in range(0,len(data),BULK_PACKETS * BULK_PACKET_SIZE):
+      chunk = bytes(data[i:i+BULK_PACKETS * BULK_PACKET_SIZE])
+      frames.append((BULK_WRITE,start + i,len(chunk) // BULK_PACKET_SIZE,chunk))
+    seq = 0
+    for op,addr,length,chunk in frames:
+      self.bulk_frame(op,seq,addr,length,chunk)
+      if seq % BULK_WINDOW == BULK_WINDOW - 1:
+        self.bulk_ack(seq)
+      seq += 1
+    self.bulk_frame(BULK_SYNC,seq,0)
+    self.bulk_ack(seq)
+    usb.util.release_interface(self.dev,BULK_INTERFACE)
+    # Let the DFU interface check the image and start it
+    self.set_address(address)
+    self.manifest()
+
+  def send(self,data):
+    """Send a .patch or .dfz file"""
+    data = bytearray(data)
+    if data[:4] == b'DFUP':
+      self.patch(data)
+    elif data[:4] == b'DFUZ':
+      data = data[4:]
+      while data:
+        address,size = struct.unpack('<2I',bytes(data[:8]))
+        self.compressed(address,data[8:8+size])
+        data = data[8+size:]
+    else:
+      raise ValueError('Unknown file format')
+    self.manifest()
+
+if __name__=="__main__":
+  from optparse import OptionParser
+  parser = OptionParser(usage="%prog [{-D|--device}=vendor:device] [{-b|--bulk}=address] infile.dfz|infile.patch|infile.bin|infile.dfu")
+  parser.add_option("-D", "--device", action="store", dest="device",
+    default=DEFAULT_DEVICE, help="vendor:device of the bootloader", metavar="DEVICE")
+  parser.add_option("-d", "--diff", action="store_true", dest="diff", default=False,
+    help="write only the pages of a DfuSe file which differ from flash")
+  parser.add_option("-b", "--bulk", action="store", dest="bulk",
+    help="write a raw binary at ADDRESS through the bulk interface", metavar="ADDRESS")
+  parser.add_option("-s", "--stats", action="store_true", dest="stats", default=False,
+    help="print the update statistics of the device")
+  parser.add_option("-t", "--times", action="store_true", dest="times", default=False,
+    help="print the bring-up times of the device")
+  (options, args) = parser.parse_args()
+  if options.times:
+    for name,us in DfuDevice.find(options.device).bringup_times():
+      print('%-10s %s' % (name,'-' if us is None else '%.2f ms' % (us / 1000.0)))
+    sys.exit(0)
+  if options.stats:
+    for r in DfuDevice.find(options.device).stats():
+      print('session %(session)d: %(written)d bytes, %(erased)d pages, %(elapsed_ms)d ms, '
+        'error %(error)d%(state)s, %(interrupted)d interrupted before' % dict(r,state=' (open)' if r['open'] else ''))
+    sys.exit(0)
+  if len(args) != 1:
+    parser.print_help()
+    sys.exit(1)
+  device = DfuDevice.find(options.device)
+  if options.diff:
+    print('%d pages written' % device.flash_diff(read_dfuse(open(args[0],'rb').read())))
+  elif options.bulk:
+    device.bulk_download(int(options.bulk,0),open(args[0],'rb').read())
+  else:
+    device.send(open(args[0],'rb').read())
@@ -0,0 +1,147 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <pic18fregs.h>
+
+#include "typedef.h"
+#include "eeprom.h"
+
+#pragma stack 0x200 255
+
+/*
+ * Startup and interrupt latency benchmark, 'make bench' ('make
+ * bench-sim' runs it under gpsim together with the bootloader)
+ *
+ * Startup: the first instruction of main raises MARK_PIN, the cycles
+ * from reset are taken by gpsim (bench.stc) or with a scope between
+ * MCLR and the pin. With the bottom layout this includes the boot
+ * decision of the bootloader and the goto at ENTRY.
+ *
+ * Interrupts: Timer1 and Timer3 run at Fosc/4 and overflow a few cycles
+ * after they are started, the handlers read the low byte of the timer
+ * first, so the count is the number of instruction cycles from the
+ * overflow to the handler. The high priority handler is naked and
+ * shows the hardware latency plus the vector gotos (bootloader
+ * trampoline and the goto of SDCC at ENTRY + 0x0008), the low priority
+ * handler is plain C and adds the context save of SDCC.
+ *
+ * Minimum and maximum of SAMPLES runs are written to the data EEPROM
+ * at BENCH_EEPROM in the order high min, high max, low min, low max,
+ * then MARK_PIN goes low again.
+ */
+#define MARK_PIN_TRIS TRISBbits.TRISB1
+#define MARK_PIN LATBbits.LATB1
+#define SAMPLES 16
+#define TIMER_LEAD 16            // cycles from start to overflow
+#define TIMER_RUN 0x81           // RD16, 1:1, Fosc/4, on
+#define NO_COUNT 0xFF
+#define BENCH_EEPROM 0x00
+
+volatile u8 high_count;
+volatile u8 low_count;
+
+u8 bench_result[4];
+
+void high_isr(void) __naked __interrupt 1 {
+	high_count = TMR1L;
+	PIR1bits.TMR1IF = 0;
+	__asm
+		retfie 1
+	__endasm;
+}
+
+void low_isr(void) __interrupt 2 {
+	low_count = TMR3L;
+	PIR2bits.TMR3IF = 0;
+}
+
+/*
+ * The lead changes with the sample, so the overflow hits every
+ * instruction of the wait loop
+ */
+static u8 measure_high(u8 sample) {
+	high_count = NO_COUNT;
+	TMR1H = 0xFF;
+	TMR1L = 0x100 - TIMER_LEAD - (sample & 3);
+	T1CON = TIMER_RUN;
+	while (high_count == NO_COUNT);
+	T1CON = 0;
+	return high_count;
+}
+
+static u8 measure_low(u8 sample) {
+	low_count = NO_COUNT;
+	TMR3H = 0xFF;
+	TMR3L = 0x100 - TIMER_LEAD - (sample & 3);
+	T3CON = TIMER_RUN;
+	while (low_count == NO_COUNT);
+	T3CON = 0;
+	return low_count;
+}
+
+static void update(u8 *result, u8 count) {
+	if (count < result[0]) {
+		result[0] = count;
+	}
+	if (count > result[1]) {
+		result[1] = count;
+	}
+}
+
+static void bench(void) {
+	u8 sample;
+
+	bench_result[0] = 0xFF;
+	bench_result[1] = 0;
+	bench_result[2] = 0xFF;
+	bench_result[3] = 0;
+
+	T1CON = 0;
+	T3CON = 0;
+	PIR1bits.TMR1IF = 0;
+	PIR2bits.TMR3IF = 0;
+	IPR1bits.TMR1IP = 1;
+	IPR2bits.TMR3IP = 0;
+	PIE1bits.TMR1IE = 1;
+	PIE2bits.TMR3IE = 1;
+	RCONbits.IPEN = 1;
+	INTCONbits.GIEL = 1;
+	INTCONbits.GIEH = 1;
+
+	for (sample = 0; sample < SAMPLES; sample++) {
+		update(&bench_result[0], measure_high(sample));
+		update(&bench_result[2], measure_low(sample));
+	}
+
+	// writeEeprom leaves GIE as it was, the timers must not fire
+	PIE1bits.TMR1IE = 0;
+	PIE2bits.TMR3IE = 0;
+	writeEepromBlock(BENCH_EEPROM, bench_result, sizeof(bench_result));
+}
+
+void main(void) {
+	// No locals, so these are the first instructions of main
+	MARK_PIN_TRIS = 0;
+	MARK_PIN = 1;
+
+	bench();
+
+	MARK_PIN = 0;
+	while (1);
+}
@@ -1,14 +1,137 @@
 
+; C startup for applications started by the bootloader
+;
+; The bootloader has already set up the clock and cleared the reset
+; flags, so only the stack pointers are loaded. The bss section (usb7,
+; see the linker script) is cleared and the cinit table of gplink is
+; copied with a TBLRD loop before main is called. Uninitialized data
+; outside bss is not cleared, as with crt0i of SDCC.
+
     radix  DEC
 
     EXTERN _main
+    EXTERN _cinit
+    EXTERN _stack_end
+
+; Common to all PIC18
+STATUS   EQU 0xFD8
+FSR0L    EQU 0xFE9
+FSR0H    EQU 0xFEA
+POSTINC0 EQU 0xFEE
+TBLPTRU  EQU 0xFF8
+TBLPTRH  EQU 0xFF7
+TBLPTRL  EQU 0xFF6
+TABLAT   EQU 0xFF5
+Z        EQU 2
+W        EQU 0
+F        EQU 1
+ACCESS   EQU 0
+
+; Has to match the bss bank of the linker script
+BSS_START EQU 0x700
+BSS_SIZE  EQU 256
+
+; Temporaries of SDCC, unused before main
+ENTRIES  EQU 0x00        ; 2 bytes
+COUNT    EQU 0x02        ; 2 bytes
+SOURCE   EQU 0x04        ; 3 bytes
+TABLE    EQU 0x07        ; 3 bytes
 
 _reset code
-    pagesel _main
-    goto _main
+    goto    startup
 
 startup code
-    pagesel _main
-    goto _main
+startup:
+    lfsr    1, _stack_end
+    lfsr    2, _stack_end
+
+    ; First, idata may follow bss in the same bank
+    lfsr    0, BSS_START
+    movlw   BSS_SIZE / 4
+    movwf   COUNT, ACCESS
+clear:
+    clrf    POSTINC0, ACCESS
+    clrf    POSTINC0, ACCESS
+    clrf    POSTINC0, ACCESS
+    clrf    POSTINC0, ACCESS
+    decfsz  COUNT, F, ACCESS
+    bra     clear
+
+    ; cinit: number of entries (2 bytes), then from, to and size of
+    ; every entry (4 bytes each)
+    movlw   low _cinit
+    movwf   TBLPTRL, ACCESS
+    movlw   high _cinit
+    movwf   TBLPTRH, ACCESS
+    movlw   upper _cinit
+    movwf   TBLPTRU, ACCESS
+    tblrd*+
+    movff   TABLAT, ENTRIES
+    tblrd*+
+    movff   TABLAT, ENTRIES + 1
+
+    ; The 16 bit counters run down with decfsz on both bytes, the high
+    ; byte is incremented if the low byte does not start at 0
+    movf    ENTRIES, W, ACCESS
+    iorwf   ENTRIES + 1, W, ACCESS
+    bz      done
+    movf    ENTRIES, F, ACCESS
+    btfss   STATUS, Z, ACCESS
+    incf    ENTRIES + 1, F, ACCESS
+
+entry:
+    tblrd*+
+    movff   TABLAT, SOURCE
+    tblrd*+
+    movff   TABLAT, SOURCE + 1
+    tblrd*+
+    movff   TABLAT, SOURCE + 2
+    tblrd*+
+    tblrd*+
+    movff   TABLAT, FSR0L
+    tblrd*+
+    movff   TABLAT, FSR0H
+    tblrd*+
+    tblrd*+
+    tblrd*+
+    movff   TABLAT, COUNT
+    tblrd*+
+    movff   TABLAT, COUNT + 1
+    tblrd*+
+    tblrd*+
+
+    movf    COUNT, W, ACCESS
+    iorwf   COUNT + 1, W, ACCESS
+    bz      next
+    movf    COUNT, F, ACCESS
+    btfss   STATUS, Z, ACCESS
+    incf    COUNT + 1, F, ACCESS
+
+    movff   TBLPTRL, TABLE
+    movff   TBLPTRH, TABLE + 1
+    movff   TBLPTRU, TABLE + 2
+    movff   SOURCE, TBLPTRL
+    movff   SOURCE + 1, TBLPTRH
+    movff   SOURCE + 2, TBLPTRU
+copy:
+    tblrd*+
+    movff   TABLAT, POSTINC0
+    decfsz  COUNT, F, ACCESS
+    bra     copy
+    decfsz  COUNT + 1, F, ACCESS
+    bra     copy
+    movff   TABLE, TBLPTRL
+    movff   TABLE + 1, TBLPTRH
+    movff   TABLE + 2, TBLPTRU
+
+next:
+    decfsz  ENTRIES, F, ACCESS
+    bra     entry
+    decfsz  ENTRIES + 1, F, ACCESS
+    bra     entry
+
+done:
+    call    _main
+    bra     $
 
     END
@@ -19,10 +19,102 @@
 
 #include <pic18fregs.h>
 
+#include "typedef.h"
+#include "services.h"
+#include "dfu/runtime.h"
+
 #pragma stack 0x200 255
 
 #define LED LATBbits.LATB0
 
+/*
+ * USB device with a DFU runtime interface, the USB stack is the one of
+ * the bootloader (see bootloader/services.h). dfu-util detaches the
+ * device into the bootloader before the download.
+ */
+typedef struct {
+	USB_Configuration_Descriptor cd;
+	DFU_Runtime_Descriptor dfu;
+} Example_Configuration_Descriptor;
+
+const USB_Device_Descriptor example_device_descriptor = {
+		sizeof(USB_Device_Descriptor),    // Size of this descriptor in bytes
+		DEVICE_DESCRIPTOR,                // Device descriptor type
+		0x0100,                 // USB Spec Release Number in BCD format
+		0x00,                   // Class Code
+		0x00,                   // Subclass code
+		0x00,                   // Protocol code
+		EP0_BUFFER_SIZE,        // Max packet size for EP0
+		0x0483,                 // Vendor ID
+		0xdf12,                 // Product ID
+		0x0100,                 // Device release number in BCD format
+		0,                      // Manufacturer string index
+		1,                      // Product string index
+		0,                      // Device serial number string index
+		1                       // Number of possible configurations
+		};
+
+const Example_Configuration_Descriptor example_cfg = {
+		{ sizeof(USB_Configuration_Descriptor), // Size of this descriptor in bytes
+				CONFIGURATION_DESCRIPTOR,       // CONFIGURATION descriptor type
+				sizeof(example_cfg),    // Total length of data for this configuration
+				1,                      // Number of interfaces in this configuration
+				1,                      // Index value of this configuration
+				0,                      // Configuration string index
+				DEFAULT,                // Attributes
+				50 },                   // Max power consumption (2X mA)
+		RUNTIME_DFU_DESCRIPTOR(0) };
+
+const u8 * const example_configuration_descriptor[] = {
+		(const u8*) &example_cfg };
+
+const u8 example_str0[] = {sizeof(example_str0), STRING_DESCRIPTOR, 0x09,0x04};
+
+const u8 example_str1[] = {sizeof(example_str1), STRING_DESCRIPTOR,
+                                              'E',0x00,
+                                              'x',0x00,
+                                              'a',0x00,
+                                              'm',0x00,
+                                              'p',0x00,
+                                              'l',0x00,
+                                              'e',0x00};
+
+const u8 * const example_string_descriptor[] = {example_str0, example_str1};
+
+void null_function() __naked
+{
+    __asm
+        return
+    __endasm;
+}
+
+static void (* const example_ep_init_cfg [])(void) = {
+		service_ep0_init, null_function, null_function, null_function,
+		null_function, null_function, null_function, null_function,
+		null_function, null_function, null_function, null_function,
+		null_function, null_function, null_function, null_function};
+
+// Only endpoint 0 is enabled, so only entry 0 is dispatched
+static void (* const example_ep_in_cfg [])(void) = { service_ep0_in };
+static void (* const example_ep_out_cfg [])(void) = { service_ep0_out };
+static void (* const example_ep_setup_cfg [])(void) = { service_ep0_setup };
+
+void (** const example_ep_init[])(void) = { example_ep_init_cfg, example_ep_init_cfg };
+void (** const example_ep_in[])(void) = { example_ep_in_cfg, example_ep_in_cfg };
+void (** const example_ep_out[])(void) = { example_ep_out_cfg, example_ep_out_cfg };
+void (** const example_ep_setup[])(void) = { example_ep_setup_cfg, example_ep_setup_cfg };
+
+const ApplicationData example_application = {
+		&example_device_descriptor,
+		(const void **) example_configuration_descriptor,
+		example_string_descriptor,
+		example_ep_init,
+		example_ep_in,
+		example_ep_out,
+		example_ep_setup,
+		runtime_dfu_request,
+		0 };
+
 void delay_ms(unsigned int duration) {
 	unsigned int i;
 	unsigned int j;
@@ -42,13 +134,24 @@ void delay_ms(unsigned int duration) {
 }
 
 void main(void) {
+	unsigned int ms = 0;
+
 	TRISBbits.TRISB0 = 0;
 
+	service_usb_register(&example_application);
+	service_init_usb();
+	service_enable_usb();
+
 	while (1) {
-		LED = 1;
-		delay_ms(500);
-		LED = 0;
-		delay_ms(500);
+		service_dispatch_usb_event();
+		runtime_dfu_task();
+
+		// USB is polled, so the LED is toggled from a millisecond count
+		delay_ms(1);
+		if (++ms == 500) {
+			ms = 0;
+			LED = !LED;
+		}
 	}
 
 }
@@ -0,0 +1,213 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Special function registers of the host build, plain variables (sfr.c)
+ * with the bit layout of the PIC18F2550. prepare.py turns the inline
+ * assembly of the bootloader into calls of the host_* functions.
+ */
+
+#ifndef HOST_PIC18FREGS_H
+#define HOST_PIC18FREGS_H
+
+#include "typedef.h"
+
+#define Sleep()
+#define Reset()
+
+/* dfu.c brings its own memcpy with a 16 bit count */
+#define memcpy boot_memcpy
+
+#define SFR(name) extern volatile unsigned char name
+#define SFR_BITS(name, type) \
+	extern volatile unsigned char name; \
+	typedef struct type name##bits_t
+#define BITS(name) (*(volatile name##bits_t *) &name)
+
+SFR_BITS(UCON, {
+	unsigned char :1;
+	unsigned char SUSPND :1;
+	unsigned char RESUME :1;
+	unsigned char USBEN :1;
+	unsigned char PKTDIS :1;
+	unsigned char SE0 :1;
+	unsigned char PPBRST :1;
+	unsigned char :1;
+});
+#define USB_INT_BITS(f) { \
+	unsigned char URST##f :1; \
+	unsigned char UERR##f :1; \
+	unsigned char ACTV##f :1; \
+	unsigned char TRN##f :1; \
+	unsigned char IDLE##f :1; \
+	unsigned char STALL##f :1; \
+	unsigned char SOF##f :1; \
+	unsigned char :1; \
+}
+SFR_BITS(UIR, USB_INT_BITS(IF));
+SFR_BITS(UIE, USB_INT_BITS(IE));
+
+SFR_BITS(USTAT, {
+	unsigned char :1;
+	unsigned char PPBI :1;
+	unsigned char DIR :1;
+	unsigned char ENDP :4;
+	unsigned char :1;
+});
+
+SFR_BITS(UEP0, {
+	unsigned char EPSTALL :1;
+	unsigned char EPINEN :1;
+	unsigned char EPOUTEN :1;
+	unsigned char EPCONDIS :1;
+	unsigned char EPHSHK :1;
+	unsigned char :3;
+});
+
+SFR(UCFG);
+SFR(UADDR);
+SFR(UEIR);
+SFR(UEIE);
+SFR(UFRML);
+SFR(UFRMH);
+SFR(UEP1);
+SFR(UEP2);
+SFR(UEP3);
+SFR(UEP4);
+SFR(UEP5);
+SFR(UEP6);
+SFR(UEP7);
+SFR(UEP8);
+SFR(UEP9);
+SFR(UEP10);
+SFR(UEP11);
+SFR(UEP12);
+SFR(UEP13);
+SFR(UEP14);
+SFR(UEP15);
+
+SFR_BITS(PIR2, {
+	unsigned char CCP2IF :1;
+	unsigned char TMR3IF :1;
+	unsigned char HLVDIF :1;
+	unsigned char BCLIF :1;
+	unsigned char EEIF :1;
+	unsigned char USBIF :1;
+	unsigned char CMIF :1;
+	unsigned char OSCFIF :1;
+});
+
+SFR_BITS(PIE2, {
+	unsigned char CCP2IE :1;
+	unsigned char TMR3IE :1;
+	unsigned char HLVDIE :1;
+	unsigned char BCLIE :1;
+	unsigned char EEIE :1;
+	unsigned char USBIE :1;
+	unsigned char CMIE :1;
+	unsigned char OSCFIE :1;
+});
+
+SFR_BITS(INTCON, {
+	unsigned char RBIF :1;
+	unsigned char INT0IF :1;
+	unsigned char TMR0IF :1;
+	unsigned char RBIE :1;
+	unsigned char INT0IE :1;
+	unsigned char TMR0IE :1;
+	unsigned char PEIE :1;
+	unsigned char GIE :1;
+});
+
+SFR_BITS(RCON, {
+	unsigned char BOR :1;
+	unsigned char POR :1;
+	unsigned char PD :1;
+	unsigned char TO :1;
+	unsigned char RI :1;
+	unsigned char :1;
+	unsigned char SBOREN :1;
+	unsigned char IPEN :1;
+});
+
+SFR_BITS(RCSTA, {
+	unsigned char RX9D :1;
+	unsigned char OERR :1;
+	unsigned char FERR :1;
+	unsigned char ADDEN :1;
+	unsigned char CREN :1;
+	unsigned char SREN :1;
+	unsigned char RX9 :1;
+	unsigned char SPEN :1;
+});
+
+SFR_BITS(TXSTA, {
+	unsigned char TX9D :1;
+	unsigned char TRMT :1;
+	unsigned char BRGH :1;
+	unsigned char SENDB :1;
+	unsigned char SYNC :1;
+	unsigned char TXEN :1;
+	unsigned char TX9 :1;
+	unsigned char CSRC :1;
+});
+
+SFR_BITS(EECON1, {
+	unsigned char RD :1;
+	unsigned char WR :1;
+	unsigned char WREN :1;
+	unsigned char WRERR :1;
+	unsigned char FREE :1;
+	unsigned char :1;
+	unsigned char CFGS :1;
+	unsigned char EEPGD :1;
+});
+
+SFR(T0CON);
+SFR(TMR0L);
+SFR(TMR0H);
+SFR(EECON2);
+SFR(EEADR);
+SFR(EEDATA);
+SFR(TBLPTRL);
+SFR(TBLPTRH);
+SFR(TBLPTRU);
+SFR(TABLAT);
+
+#define UCONbits BITS(UCON)
+#define UIRbits BITS(UIR)
+#define UIEbits BITS(UIE)
+#define USTATbits BITS(USTAT)
+#define UEP0bits BITS(UEP0)
+#define PIR2bits BITS(PIR2)
+#define PIE2bits BITS(PIE2)
+#define INTCONbits BITS(INTCON)
+#define RCONbits BITS(RCON)
+#define RCSTAbits BITS(RCSTA)
+#define TXSTAbits BITS(TXSTA)
+#define EECON1bits BITS(EECON1)
+
+/* Inline assembly and hardware cycles, see prepare.py */
+void host_tblrd(int step);
+void host_tblwt(int step);
+void host_read_cycle(void);
+void host_write_cycle(void);
+void host_jump(unsigned long address);
+
+#endif
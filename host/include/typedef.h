@@ -0,0 +1,54 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * bootloader/typedef.h with the integer sizes of SDCC, the SDCC keywords
+ * are dropped as every source includes this header
+ */
+
+#ifndef HOST_TYPEDEF_H
+#define HOST_TYPEDEF_H
+
+#include <stdint.h>
+
+/* SDCC keywords */
+#define __at(x)
+#define __data
+#define __code
+#define far
+#define __naked
+
+#define TRUE 1
+#define FALSE 0
+
+#define HIGHB(x)  ((x) >> 8)
+#define LOWB(x)   ((x) & 0xFF)
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+// Host only, for the replay timings
+typedef uint64_t u64;
+
+#endif
@@ -0,0 +1,61 @@
+#!/usr/bin/python
+
+# Copies the bootloader sources for the host build
+# Distributed under Gnu LGPL 3.0
+# see http://www.gnu.org/licenses/lgpl-3.0.txt
+#
+# Inline assembly becomes calls of the host_* functions of sfr.c, the
+# hardware cycles started by EECON1bits.WR/RD are run right away and
+# the SDCC pragmas are dropped. typedef.h is taken from include/.
+
+import sys,os,re,io
+
+ASM = {
+  'TBLRD*+': 'host_tblrd(1);',
+  'TBLRD*-': 'host_tblrd(-1);',
+  'TBLWT*+': 'host_tblwt(1);',
+  'NOP': '',
+  'RETURN': 'return;',
+}
+
+def asm(match):
+  code = []
+  for line in match.group(1).splitlines():
+    line = line.split(';')[0].strip()
+    if not line:
+      continue
+    if line.upper() in ASM:
+      code.append(ASM[line.upper()])
+    elif line.lower().startswith('goto '):
+      code.append('host_jump(%s);' % line[5:].strip())
+    else:
+      raise ValueError('no host code for "%s"' % line)
+  return ' '.join(c for c in code if c)
+
+def self_sizeof(match):
+  # SDCC accepts the size of the array in its own initializer, gcc gets
+  # a compound literal with the same elements
+  rest = match.group(3)
+  return '%ssizeof((const u8[]) {0%s)%s' % (match.group(1),rest,rest)
+
+def prepare(source):
+  source = re.sub(r'__asm(.*?)__endasm\s*;',asm,source,flags=re.S)
+  source = re.sub(r'^\s*#pragma[^\n]*$','',source,flags=re.M)
+  source = re.sub(r'(EECON1bits\.WR\s*=\s*1\s*;)',r'\1 host_write_cycle();',source)
+  source = re.sub(r'(EECON1bits\.RD\s*=\s*1\s*;)',r'\1 host_read_cycle();',source)
+  source = re.sub(r'(\b(\w+)\[\]\s*=\s*\{\s*)sizeof\(\2\)([^{}]*\})',self_sizeof,source)
+  return source
+
+if __name__=="__main__":
+  if len(sys.argv) != 3:
+    print("usage: prepare.py source.c output.c")
+    sys.exit(1)
+  try:
+    source = prepare(io.open(sys.argv[1],encoding='latin-1').read())
+  except ValueError as e:
+    print("%s: %s" % (sys.argv[1],e))
+    sys.exit(1)
+  d = os.path.dirname(sys.argv[2])
+  if d and not os.path.isdir(d):
+    os.makedirs(d)
+  io.open(sys.argv[2],'w',encoding='latin-1').write(source)
@@ -0,0 +1,804 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Replays control transfers against the host build of the bootloader
+ *
+ * The SIE is emulated on the buffer descriptors of endpoint 0: a token
+ * is accepted if the SIE owns the buffer, answered with STALL if
+ * BSTALL is set and NAKed otherwise, then TRNIF is raised and one pass
+ * of the main loop of main.c runs. NAKed tokens are retried after
+ * another pass, like the host does in the next frame.
+ *
+ * Every run starts in a fresh process (fork), the time of a transfer
+ * is the minimum over all runs, the longest single dispatch the
+ * maximum. The times are host nanoseconds, only useful to compare
+ * requests and versions of the firmware with each other.
+ *
+ * Traces are usbmon text (the 'S' lines of endpoint 0) or one request
+ * per line:
+ *
+ *   bmRequestType bRequest wValue wIndex wLength [data]
+ *
+ * all numbers hex, data as hex bytes or XX*count, a line 'reset' is a
+ * bus reset and # starts a comment. Data stages missing in the trace
+ * (usbmon keeps only the first 32 bytes) are filled with 0xFF.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "pic18fregs.h"
+#include "typedef.h"
+#include "config.h"
+#include "usb/usb_descriptors.h"
+#include "usb/usb_std_req.h"
+#include "usb/usb.h"
+#include "dfu/dfu.h"
+#include "stats.h"
+#include "bringup.h"
+#include "sfr.h"
+
+#undef memcpy
+
+#define MAX_TOKENS 64
+#define NAK_LIMIT 20000          // manifestation takes 10000 passes
+#define IN_KEEP 64
+#define DFU_STATES 11
+#define USB_STATES 8
+
+enum {
+	ACK, NAK, STALL
+};
+
+typedef struct {
+	int line;
+	u8 reset;
+	u8 setup[8];
+	u8 *data;                // data stage of host to device requests
+	u8 padded;
+} TraceEntry;
+
+typedef struct {
+	u64 usb_ns;              // dispatch_usb_event of all stages
+	u64 work_ns;             // rest of the main loop
+	u64 worst_ns;            // longest single dispatch
+	u32 naks;
+	u16 in_length;
+	u8 stalled;
+	u8 timeout;
+	u8 dfu_before;
+	u8 dfu_after;
+	u8 usb_before;
+	u8 usb_after;
+	u8 in_data[IN_KEEP];
+} Timing;
+
+typedef struct {
+	u8 data[EP0_BUFFER_SIZE];
+	u8 length;
+} Packet;
+
+static Timing *current;
+static Packet packet;
+static u16 reset_timeout;
+static u16 frame;
+
+static const char * const standard_names[] = {
+	"GET_STATUS", "CLEAR_FEATURE", NULL, "SET_FEATURE", NULL,
+	"SET_ADDRESS", "GET_DESCRIPTOR", "SET_DESCRIPTOR", "GET_CONFIGURATION",
+	"SET_CONFIGURATION", "GET_INTERFACE", "SET_INTERFACE", "SYNCH_FRAME"
+};
+
+static const char * const dfu_names[] = {
+	"DFU_DETACH", "DFU_DNLOAD", "DFU_UPLOAD", "DFU_GETSTATUS",
+	"DFU_CLRSTATUS", "DFU_GETSTATE", "DFU_ABORT"
+};
+
+static const char * const vendor_names[] = {
+	NULL, "VENDOR_GET_JOURNAL", "VENDOR_GET_PAGE_CRC", "VENDOR_GET_ERROR",
+	"VENDOR_GET_STATS", "VENDOR_GET_BRINGUP"
+};
+
+static const char * const dfu_state_names[DFU_STATES] = {
+	"appIDLE", "appDETACH", "dfuIDLE", "dfuDNLOAD_SYNC", "dfuDNBUSY",
+	"dfuDNLOAD_IDLE", "dfuMANIFEST_SYNC", "dfuMANIFEST",
+	"dfuMANIFEST_WAIT_RESET", "dfuUPLOAD_IDLE", "dfuERROR"
+};
+
+static const char * const usb_state_names[USB_STATES] = {
+	"DETACHED", "ATTACHED", "POWERED", "DEFAULT", "ADDRESS_PENDING",
+	"ADDRESS", "CONFIGURATION_PENDING", "CONFIGURED"
+};
+
+static u64 now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (u64) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/*
+ * One pass of the main loop of main.c
+ */
+static void main_loop(void) {
+	u64 start, dispatched, done;
+
+	start = now();
+	dispatch_usb_event();
+	dispatched = now();
+	stats_tick();
+	if (dfuOperationStarted()) {
+		dfuFinishOperation();
+	}
+	if (dfuIsManifest() && reset_timeout == 0) {
+		dfuManifest();
+	}
+	if (dfuIsManifest()) {
+		reset_timeout++;
+	}
+	if (reset_timeout > 0) {
+		reset_timeout++;
+	}
+	if (reset_timeout > 10000) {
+		setManifestWaitReset();
+		close_usb();
+		jump_to_app();
+	}
+	done = now();
+
+	current->usb_ns += dispatched - start;
+	if (dispatched - start > current->worst_ns) {
+		current->worst_ns = dispatched - start;
+	}
+	current->work_ns += done - dispatched;
+}
+
+/*
+ * A transaction on endpoint 0 has finished
+ */
+static int complete(u8 direction) {
+	USTAT = direction << 2;
+	UIRbits.TRNIF = 1;
+	main_loop();
+	return ACK;
+}
+
+static int stall_token(void) {
+	UIRbits.STALLIF = 1;
+	main_loop();
+	return STALL;
+}
+
+/*
+ * SETUP is accepted even if the buffer is stalled
+ */
+static int setup_token(void) {
+	volatile BufferDescriptorTable *bd = &EP_OUT_BD(0);
+
+	if (!bd->Stat.UOWN) {
+		return NAK;
+	}
+	memcpy(bd->ADR, packet.data, 8);
+	bd->Cnt = 8;
+	bd->Stat.uc = (bd->Stat.uc & BDS_DAT1) | SETUP_TOKEN << 2;
+	UCONbits.PKTDIS = 1;
+	return complete(OUT);
+}
+
+static int out_token(void) {
+	volatile BufferDescriptorTable *bd = &EP_OUT_BD(0);
+
+	if (UCONbits.PKTDIS || !bd->Stat.UOWN) {
+		return NAK;
+	}
+	if (bd->Stat.BSTALL) {
+		return stall_token();
+	}
+	if (packet.length > bd->Cnt) {
+		packet.length = bd->Cnt;
+	}
+	memcpy(bd->ADR, packet.data, packet.length);
+	bd->Cnt = packet.length;
+	bd->Stat.uc = (bd->Stat.uc & BDS_DAT1) | OUT_TOKEN << 2;
+	return complete(OUT);
+}
+
+static int in_token(void) {
+	volatile BufferDescriptorTable *bd = &EP_IN_BD(0);
+
+	if (UCONbits.PKTDIS || !bd->Stat.UOWN) {
+		return NAK;
+	}
+	if (bd->Stat.BSTALL) {
+		return stall_token();
+	}
+	packet.length = bd->Cnt;
+	memcpy(packet.data, bd->ADR, packet.length);
+	bd->Stat.uc = (bd->Stat.uc & BDS_DAT1) | IN_TOKEN << 2;
+	return complete(IN);
+}
+
+/*
+ * A token with the retries of the host
+ */
+static int transaction(int (*token)(void)) {
+	u16 tries;
+	int status;
+
+	for (tries = 0; tries < NAK_LIMIT && !host_jumped; tries++) {
+		status = token();
+		if (status == STALL) {
+			current->stalled = TRUE;
+		}
+		if (status != NAK) {
+			return status;
+		}
+		current->naks++;
+		main_loop();
+	}
+	current->timeout = TRUE;
+	return NAK;
+}
+
+static void control_transfer(const TraceEntry *entry) {
+	u16 length = entry->setup[6] | entry->setup[7] << 8;
+	u16 done;
+
+	memcpy(packet.data, entry->setup, 8);
+	packet.length = 8;
+	if (transaction(setup_token) != ACK) {
+		return;
+	}
+
+	if (entry->setup[0] & 0x80) {
+		for (done = 0; done < length; done += packet.length) {
+			if (transaction(in_token) != ACK) {
+				return;
+			}
+			if (done < IN_KEEP) {
+				memcpy(&current->in_data[done], packet.data,
+						done + packet.length > IN_KEEP ? IN_KEEP - done : packet.length);
+			}
+			current->in_length = done + packet.length;
+			if (packet.length < EP0_BUFFER_SIZE) {
+				break;
+			}
+		}
+		packet.length = 0;
+		transaction(out_token);
+	} else {
+		for (done = 0; done < length; done += packet.length) {
+			packet.length = length - done < EP0_BUFFER_SIZE ? length - done : EP0_BUFFER_SIZE;
+			memcpy(packet.data, &entry->data[done], packet.length);
+			if (transaction(out_token) != ACK) {
+				return;
+			}
+		}
+		transaction(in_token);
+	}
+}
+
+static void bus_reset_signal(void) {
+	UIRbits.URSTIF = 1;
+	main_loop();
+}
+
+/*
+ * Every transfer takes a frame, Timer0 of the bring-up times advances
+ * by 1 ms (47 ticks)
+ */
+static void next_frame(void) {
+	u16 ticks = (TMR0L | TMR0H << 8) + 47;
+
+	frame = (frame + 1) & 0x7FF;
+	UFRML = frame & 0xFF;
+	UFRMH = frame >> 8;
+	TMR0L = ticks & 0xFF;
+	TMR0H = ticks >> 8;
+}
+
+/*
+ * Bring-up of main.c up to the first bus reset
+ */
+static void boot(void) {
+	u64 start = now();
+
+	bringup_start();
+	bringup_mark(BRINGUP_DECIDED);
+	device_descriptor = &boot_device_descriptor;
+	configuration_descriptor = (const void **) boot_configuration_descriptor;
+	string_descriptor = boot_string_descriptor;
+	ep_init = (void (***)(void)) boot_ep_init;
+	ep_in = (void (***)(void)) boot_ep_in;
+	ep_out = (void (***)(void)) boot_ep_out;
+	ep_setup = (void (***)(void)) boot_ep_setup;
+	application_data = 0;
+
+	init_usb();
+	enable_usb();
+	init_dfu();
+	current->work_ns += now() - start;
+
+	main_loop();
+	bus_reset_signal();
+}
+
+static void state_before(Timing *timing) {
+	timing->dfu_before = dfu_status.bState;
+	timing->usb_before = GET_DEVICE_STATE();
+}
+
+static void state_after(Timing *timing) {
+	timing->dfu_after = dfu_status.bState;
+	timing->usb_after = GET_DEVICE_STATE();
+}
+
+/*
+ * One replay of the trace, timings[0] is the bring-up
+ */
+static void run(const TraceEntry *entries, int count, Timing *timings) {
+	int i;
+
+	host_memory_reset();
+	current = &timings[0];
+	state_before(current);
+	boot();
+	state_after(current);
+
+	for (i = 0; i < count; i++) {
+		current = &timings[i + 1];
+		state_before(current);
+		if (host_jumped) {
+			current->timeout = TRUE;
+		} else if (entries[i].reset) {
+			bus_reset_signal();
+		} else {
+			next_frame();
+			control_transfer(&entries[i]);
+		}
+		state_after(current);
+	}
+}
+
+/*
+ * Trace parsing
+ */
+
+static int hex_byte(const char *s, u8 *value) {
+	unsigned int v;
+
+	if (!isxdigit((unsigned char) s[0]) || !isxdigit((unsigned char) s[1])) {
+		return FALSE;
+	}
+	sscanf(s, "%2x", &v);
+	*value = v;
+	return TRUE;
+}
+
+/*
+ * Hex digits of the tokens, repeat counts with XX*count
+ */
+static int parse_data(char **tokens, int n, u8 *data, u16 size, u16 *length) {
+	int i;
+
+	*length = 0;
+	for (i = 0; i < n; i++) {
+		char *s = tokens[i];
+		char *star = strchr(s, '*');
+		u8 value;
+
+		if (star) {
+			long repeat = strtol(star + 1, NULL, 0);
+			if (star - s != 2 || !hex_byte(s, &value) || repeat < 0) {
+				return FALSE;
+			}
+			while (repeat-- > 0 && *length < size) {
+				data[(*length)++] = value;
+			}
+			continue;
+		}
+		for (; *s; s += 2) {
+			if (!hex_byte(s, &value)) {
+				return FALSE;
+			}
+			if (*length < size) {
+				data[(*length)++] = value;
+			}
+		}
+	}
+	return TRUE;
+}
+
+static int parse_setup(char **tokens, u8 *setup) {
+	unsigned long v[5];
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		char *end;
+		v[i] = strtoul(tokens[i], &end, 16);
+		if (*end || v[i] > (i < 2 ? 0xFF : 0xFFFF)) {
+			return FALSE;
+		}
+	}
+	setup[0] = v[0];
+	setup[1] = v[1];
+	for (i = 0; i < 3; i++) {
+		setup[2 + i * 2] = v[2 + i] & 0xFF;
+		setup[3 + i * 2] = v[2 + i] >> 8;
+	}
+	return TRUE;
+}
+
+static int usbmon_line(char **tokens, int n) {
+	return n >= 4 && strlen(tokens[2]) == 1 && strchr("SCE", tokens[2][0])
+			&& strchr(tokens[3], ':');
+}
+
+/*
+ * 1 for a request, 0 for lines without one, -1 for errors
+ */
+static int parse_line(char *line, int number, TraceEntry *entry) {
+	char *tokens[MAX_TOKENS];
+	char **data;
+	int n = 0, n_data;
+	u16 length, received;
+	char *s;
+
+	if ((s = strchr(line, '#'))) {
+		*s = 0;
+	}
+	for (s = strtok(line, " \t\r\n"); s && n < MAX_TOKENS; s = strtok(NULL, " \t\r\n")) {
+		tokens[n++] = s;
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	memset(entry, 0, sizeof(*entry));
+	entry->line = number;
+
+	if (n == 1 && !strcmp(tokens[0], "reset")) {
+		entry->reset = TRUE;
+		return 1;
+	}
+
+	if (usbmon_line(tokens, n)) {
+		// Submissions of control transfers on endpoint 0
+		s = strrchr(tokens[3], ':');
+		if (tokens[2][0] != 'S' || tokens[3][0] != 'C' || strcmp(s, ":0")
+				|| n < 10 || strcmp(tokens[4], "s")) {
+			return 0;
+		}
+		if (!parse_setup(&tokens[5], entry->setup)) {
+			return -1;
+		}
+		data = n > 12 && !strcmp(tokens[11], "=") ? &tokens[12] : NULL;
+		n_data = data ? n - 12 : 0;
+	} else {
+		if (n < 5 || !parse_setup(tokens, entry->setup)) {
+			return -1;
+		}
+		data = &tokens[5];
+		n_data = n - 5;
+	}
+
+	length = entry->setup[6] | entry->setup[7] << 8;
+	if (entry->setup[0] & 0x80 || length == 0) {
+		return 1;
+	}
+	entry->data = malloc(length);
+	memset(entry->data, 0xFF, length);
+	if (!parse_data(data, n_data, entry->data, length, &received)) {
+		return -1;
+	}
+	entry->padded = received < length;
+	return 1;
+}
+
+static TraceEntry *read_trace(const char *name, int *count) {
+	FILE *f = fopen(name, "r");
+	TraceEntry *entries = NULL;
+	char line[4096];
+	int number = 0, size = 0;
+
+	*count = -1;
+	if (!f) {
+		perror(name);
+		return NULL;
+	}
+	*count = 0;
+	while (fgets(line, sizeof(line), f)) {
+		TraceEntry entry;
+		int status = parse_line(line, ++number, &entry);
+
+		if (status < 0) {
+			fprintf(stderr, "%s:%d: no request\n", name, number);
+			fclose(f);
+			*count = -1;
+			return NULL;
+		}
+		if (status == 0) {
+			continue;
+		}
+		if (*count == size) {
+			size = size ? size * 2 : 256;
+			entries = realloc(entries, size * sizeof(TraceEntry));
+		}
+		entries[(*count)++] = entry;
+	}
+	fclose(f);
+	return entries;
+}
+
+/*
+ * Report
+ */
+
+static const char *request_name(const TraceEntry *entry, char *buffer) {
+	u8 type = (entry->setup[0] >> 5) & 0x03;
+	u8 request = entry->setup[1];
+	const char *name = NULL;
+
+	if (entry->reset) {
+		return "reset";
+	}
+	if (type == STANDARD && request < sizeof(standard_names) / sizeof(standard_names[0])) {
+		name = standard_names[request];
+	} else if (type == CLASS && request < sizeof(dfu_names) / sizeof(dfu_names[0])) {
+		name = dfu_names[request];
+	} else if (type == VENDOR && request < sizeof(vendor_names) / sizeof(vendor_names[0])) {
+		name = vendor_names[request];
+	}
+	if (!name) {
+		sprintf(buffer, "0x%02x/0x%02x", entry->setup[0], request);
+		name = buffer;
+	}
+	return name;
+}
+
+static const char *dfu_state_name(u8 state) {
+	return state < DFU_STATES ? dfu_state_names[state] : "?";
+}
+
+static const char *result_name(const Timing *timing) {
+	if (timing->timeout) {
+		return "timeout";
+	}
+	return timing->stalled ? "stall" : "ok";
+}
+
+typedef struct {
+	char name[24];
+	u32 count;
+	u64 usb_ns;
+	u64 worst_ns;
+} Kind;
+
+static Kind *find_kind(Kind *kinds, int *n, const char *name) {
+	int i;
+
+	for (i = 0; i < *n; i++) {
+		if (!strcmp(kinds[i].name, name)) {
+			return &kinds[i];
+		}
+	}
+	memset(&kinds[*n], 0, sizeof(Kind));
+	strncpy(kinds[*n].name, name, sizeof(kinds[*n].name) - 1);
+	return &kinds[(*n)++];
+}
+
+static void report(const TraceEntry *entries, int count, Timing *timings,
+		int runs, int verbose, int quiet) {
+	static u32 dfu_transitions[DFU_STATES][DFU_STATES];
+	static u32 usb_transitions[USB_STATES][USB_STATES];
+	Kind *kinds = calloc(count + 2, sizeof(Kind));
+	int n_kinds = 0;
+	u32 stalls = 0, timeouts = 0, naks = 0;
+	u64 worst = 0;
+	int worst_index = 0;
+	int i, j, r;
+
+	if (!quiet) {
+		printf(" line  request              wLength  result     naks    usb ns   work ns  worst ns  dfu state\n");
+	}
+	for (i = 0; i <= count; i++) {
+		Timing *t = &timings[i];
+		const TraceEntry *entry = i ? &entries[i - 1] : NULL;
+		char buffer[16];
+		const char *name = entry ? request_name(entry, buffer) : "bring-up";
+		Kind *kind;
+
+		// Minimum of the times, maximum of the worst dispatch
+		for (r = 1; r < runs; r++) {
+			Timing *o = &timings[r * (count + 1) + i];
+			if (o->usb_ns < t->usb_ns) {
+				t->usb_ns = o->usb_ns;
+			}
+			if (o->work_ns < t->work_ns) {
+				t->work_ns = o->work_ns;
+			}
+			if (o->worst_ns > t->worst_ns) {
+				t->worst_ns = o->worst_ns;
+			}
+		}
+
+		kind = find_kind(kinds, &n_kinds, name);
+		kind->count++;
+		kind->usb_ns += t->usb_ns;
+		if (t->worst_ns > kind->worst_ns) {
+			kind->worst_ns = t->worst_ns;
+		}
+		if (t->worst_ns > worst) {
+			worst = t->worst_ns;
+			worst_index = i;
+		}
+		stalls += t->stalled;
+		timeouts += t->timeout;
+		naks += t->naks;
+		if (t->dfu_before < DFU_STATES && t->dfu_after < DFU_STATES) {
+			dfu_transitions[t->dfu_before][t->dfu_after]++;
+		}
+		if (t->usb_before < USB_STATES && t->usb_after < USB_STATES) {
+			usb_transitions[t->usb_before][t->usb_after]++;
+		}
+
+		if (quiet) {
+			continue;
+		}
+		printf("%5d  %-20s %7u  %-8s %6u %9llu %9llu %9llu  %s", entry ? entry->line : 0, name,
+				entry ? entry->setup[6] | entry->setup[7] << 8 : 0, result_name(t), t->naks,
+				(unsigned long long) t->usb_ns, (unsigned long long) t->work_ns,
+				(unsigned long long) t->worst_ns, dfu_state_name(t->dfu_before));
+		if (t->dfu_after != t->dfu_before) {
+			printf(" -> %s", dfu_state_name(t->dfu_after));
+		}
+		if (entry && entry->padded) {
+			printf(" (data padded)");
+		}
+		printf("\n");
+		if (verbose && entry && t->in_length) {
+			printf("      in %u:", t->in_length);
+			for (j = 0; j < t->in_length && j < IN_KEEP; j++) {
+				printf(" %02x", t->in_data[j]);
+			}
+			printf("%s\n", t->in_length > IN_KEEP ? " ..." : "");
+		}
+	}
+
+	printf("\n%d requests, %d runs, %u stalled, %u timed out, %u NAKs\n",
+			count, runs, stalls, timeouts, naks);
+	printf("flash: %u rows written, %u pages erased, EEPROM: %u bytes written (last run)\n",
+			host_flash_writes, host_flash_erases, host_eeprom_writes);
+	printf("worst dispatch: %llu ns, %s", (unsigned long long) worst,
+			worst_index ? "line " : "bring-up");
+	if (worst_index) {
+		char buffer[16];
+		printf("%d %s", entries[worst_index - 1].line,
+				request_name(&entries[worst_index - 1], buffer));
+	}
+	printf("\n\n request              count   mean ns  worst ns\n");
+	for (i = 0; i < n_kinds; i++) {
+		printf(" %-20s %5u %9llu %9llu\n", kinds[i].name, kinds[i].count,
+				(unsigned long long) (kinds[i].usb_ns / kinds[i].count),
+				(unsigned long long) kinds[i].worst_ns);
+	}
+
+	printf("\n DFU state transitions\n");
+	for (i = 0; i < DFU_STATES; i++) {
+		for (j = 0; j < DFU_STATES; j++) {
+			if (i != j && dfu_transitions[i][j]) {
+				printf(" %-22s -> %-22s %5u\n", dfu_state_names[i], dfu_state_names[j],
+						dfu_transitions[i][j]);
+			}
+		}
+	}
+	printf("\n USB device state transitions\n");
+	for (i = 0; i < USB_STATES; i++) {
+		for (j = 0; j < USB_STATES; j++) {
+			if (i != j && usb_transitions[i][j]) {
+				printf(" %-22s -> %-22s %5u\n", usb_state_names[i], usb_state_names[j],
+						usb_transitions[i][j]);
+			}
+		}
+	}
+	free(kinds);
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: replay [-n runs] [-q] [-v] trace\n");
+	fprintf(stderr, "  -n runs  replay the trace runs times, default 10\n");
+	fprintf(stderr, "  -q       summary only\n");
+	fprintf(stderr, "  -v       show the data of IN transfers\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	TraceEntry *entries;
+	Timing *timings;
+	size_t size;
+	int count, runs = 10, verbose = FALSE, quiet = FALSE;
+	int option, r;
+
+	while ((option = getopt(argc, argv, "n:qv")) != -1) {
+		switch (option) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'q':
+			quiet = TRUE;
+			break;
+		case 'v':
+			verbose = TRUE;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || runs < 1) {
+		usage();
+	}
+
+	entries = read_trace(argv[optind], &count);
+	if (!entries) {
+		if (count == 0) {
+			fprintf(stderr, "%s: no requests\n", argv[optind]);
+		}
+		return 1;
+	}
+
+	// The runs write into shared memory, every run starts with the
+	// variables of a freshly started bootloader
+	size = (size_t) runs * (count + 1) * sizeof(Timing);
+	timings = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (timings == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	memset(timings, 0, size);
+
+	for (r = 1; r < runs; r++) {
+		int status;
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0) {
+			run(entries, count, &timings[r * (count + 1)]);
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "run %d failed\n", r + 1);
+			return 1;
+		}
+	}
+
+	// The first run in this process, for the memory counters
+	run(entries, count, timings);
+	report(entries, count, timings, runs, verbose, quiet);
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+/*
+ * Registers, program memory and data EEPROM of the host build. Table
+ * reads and writes, the flash write and erase cycle and the EEPROM
+ * cycles act on host memory like the hardware does.
+ */
+
+#include <string.h>
+
+#include "pic18fregs.h"
+#include "typedef.h"
+#include "config.h"
+#include "sfr.h"
+
+volatile u8 UCON, UIR, UIE, USTAT, UCFG, UADDR, UEIR, UEIE, UFRML, UFRMH;
+volatile u8 UEP0, UEP1, UEP2, UEP3, UEP4, UEP5, UEP6, UEP7;
+volatile u8 UEP8, UEP9, UEP10, UEP11, UEP12, UEP13, UEP14, UEP15;
+volatile u8 PIR2, PIE2, INTCON, RCON, RCSTA, TXSTA;
+volatile u8 T0CON, TMR0L, TMR0H;
+volatile u8 EECON1, EECON2, EEADR, EEDATA;
+volatile u8 TBLPTRL, TBLPTRH, TBLPTRU, TABLAT;
+
+u8 host_flash[FLASH_END + 1];
+u8 host_eeprom[EEPROM_SIZE];
+u32 host_flash_writes;
+u32 host_flash_erases;
+u32 host_eeprom_writes;
+u8 host_jumped;
+
+static u8 holding[FLASH_WRITE_SIZE];
+
+void host_memory_reset(void) {
+	memset(host_flash, 0xFF, sizeof(host_flash));
+	memset(host_eeprom, 0xFF, sizeof(host_eeprom));
+	memset(holding, 0xFF, sizeof(holding));
+	host_flash_writes = 0;
+	host_flash_erases = 0;
+	host_eeprom_writes = 0;
+	host_jumped = FALSE;
+}
+
+static u32 tblptr(void) {
+	return (u32) TBLPTRU << 16 | (u32) TBLPTRH << 8 | TBLPTRL;
+}
+
+static void set_tblptr(u32 address) {
+	TBLPTRL = address & 0xFF;
+	TBLPTRH = (address >> 8) & 0xFF;
+	TBLPTRU = (address >> 16) & 0x3F;
+}
+
+void host_tblrd(int step) {
+	u32 address = tblptr();
+
+	TABLAT = address <= FLASH_END ? host_flash[address] : 0xFF;
+	set_tblptr(address + step);
+}
+
+void host_tblwt(int step) {
+	u32 address = tblptr();
+
+	holding[address % FLASH_WRITE_SIZE] = TABLAT;
+	set_tblptr(address + step);
+}
+
+void host_read_cycle(void) {
+	if (!EECON1bits.EEPGD && !EECON1bits.CFGS) {
+		EEDATA = host_eeprom[EEADR % EEPROM_SIZE];
+	}
+	EECON1bits.RD = 0;
+}
+
+/*
+ * The unlock sequence is not checked, the cycle completes at once
+ */
+void host_write_cycle(void) {
+	if (EECON1bits.WREN && !EECON1bits.CFGS) {
+		if (!EECON1bits.EEPGD) {
+			host_eeprom[EEADR % EEPROM_SIZE] = EEDATA;
+			host_eeprom_writes++;
+		} else if (EECON1bits.FREE) {
+			u32 page = tblptr() & ~(u32) (ERASE_PAGE_SIZE - 1);
+			if (page <= FLASH_END) {
+				memset(&host_flash[page], 0xFF, ERASE_PAGE_SIZE);
+			}
+			host_flash_erases++;
+		} else {
+			u32 row = tblptr() & ~(u32) (FLASH_WRITE_SIZE - 1);
+			u8 i;
+			if (row <= FLASH_END) {
+				// Programming only clears bits
+				for (i = 0; i < FLASH_WRITE_SIZE; i++) {
+					host_flash[row + i] &= holding[i];
+				}
+			}
+			memset(holding, 0xFF, sizeof(holding));
+			host_flash_writes++;
+		}
+	}
+	EECON1bits.WR = 0;
+	PIR2bits.EEIF = 1;
+}
+
+void host_jump(unsigned long address) {
+	host_jumped = TRUE;
+}
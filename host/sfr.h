@@ -0,0 +1,27 @@
+/*
+ * PIC18F DFU Bootloader
+ *
+ * Author: Bernd Krumböck <krumboeck@universalnet.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+extern u8 host_flash[FLASH_END + 1];
+extern u8 host_eeprom[EEPROM_SIZE];
+extern u32 host_flash_writes;
+extern u32 host_flash_erases;
+extern u32 host_eeprom_writes;
+extern u8 host_jumped;
+
+void host_memory_reset(void);